@@ -0,0 +1,202 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <vector>
+#include <cassert>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+
+/* the size of each block the arena gets from the heap */
+static const size_t ARENA_BLOCK = 1 << 16;
+/* freed pieces are kept for reuse in 16 byte size classes up to this */
+static const size_t ARENA_MAX_CLASS = 256;
+
+struct Arena;
+
+/*
+ * Every piece starts with the arena it came from, or NULL if it came straight
+ * from the heap, and its size rounded up to 16 bytes so what follows stays
+ * aligned.
+ */
+struct ArenaHeader {
+    Arena *owner;
+    size_t size;
+};
+
+static const size_t ARENA_HEADER = (sizeof(ArenaHeader) + 15) & ~(size_t) 15;
+
+/*
+ * The arena nodes come from on this thread, if any. A node has to be freed
+ * while the arena it came from is still the current one.
+ */
+static thread_local Arena *ARENA = NULL;
+
+/*
+ * A bump allocator for the nodes of one expression at a time. Small pieces
+ * come off the end of the current block, freed ones go on a free list for
+ * their size so the copies the tree building makes don't pile up, and
+ * `reset' lets go of everything at once while keeping the blocks for the
+ * next expression. Pieces bigger than the largest size class come from the
+ * heap and go straight back to it when freed, so only the blocks are held
+ * between resets and one arena can serve a whole batch with a handful of
+ * mallocs.
+ */
+struct Arena {
+    std::vector<char *> blocks;
+    size_t current;
+    size_t used;
+    void *free_lists[ARENA_MAX_CLASS / 16];
+
+    /* what was asked for and how much of it the heap had to serve */
+    uint64_t allocations;
+    uint64_t reused;
+    uint64_t mallocs;
+    uint64_t resets;
+
+    Arena ()
+        : current(0)
+        , used(0)
+        , allocations(0)
+        , reused(0)
+        , mallocs(0)
+        , resets(0)
+    {
+        for (auto &head : free_lists)
+            head = NULL;
+    }
+
+    ~Arena ()
+    {
+        for (auto b : blocks)
+            free(b);
+    }
+
+    /* a piece of the heap which belongs to no arena */
+    static void *
+    heap_piece (size_t size)
+    {
+        ArenaHeader *h = (ArenaHeader *) malloc(ARENA_HEADER + size);
+        if (!h)
+            throw std::bad_alloc();
+        h->owner = NULL;
+        h->size = size;
+        return (char *) h + ARENA_HEADER;
+    }
+
+    void *
+    allocate (size_t size)
+    {
+        ArenaHeader *h;
+
+        size = (size + 15) & ~(size_t) 15;
+        allocations++;
+
+        if (size > ARENA_MAX_CLASS) {
+            mallocs++;
+            return heap_piece(size);
+        }
+
+        void *&head = free_lists[size / 16 - 1];
+        if (head) {
+            void *p = head;
+            head = *(void **) p;
+            reused++;
+            return p;
+        }
+
+        if (blocks.empty() || used + ARENA_HEADER + size > ARENA_BLOCK) {
+            if (!blocks.empty())
+                current++;
+            if (current == blocks.size()) {
+                char *b = (char *) malloc(ARENA_BLOCK);
+                if (!b)
+                    throw std::bad_alloc();
+                mallocs++;
+                blocks.push_back(b);
+            }
+            used = 0;
+        }
+        h = (ArenaHeader *) (blocks[current] + used);
+        h->owner = this;
+        h->size = size;
+        used += ARENA_HEADER + size;
+        return (char *) h + ARENA_HEADER;
+    }
+
+    /*
+     * Give back a piece from any arena or from the heap. A piece of an arena
+     * goes on that arena's free list, which only its own thread may touch.
+     */
+    static void
+    release (void *p)
+    {
+        ArenaHeader *h = (ArenaHeader *) ((char *) p - ARENA_HEADER);
+
+        if (!h->owner) {
+            free(h);
+            return;
+        }
+        assert(h->owner == ARENA);
+        void *&head = h->owner->free_lists[h->size / 16 - 1];
+        *(void **) p = head;
+        head = p;
+    }
+
+    /* forget every piece at once, nothing allocated from here may be used */
+    void
+    reset ()
+    {
+        for (auto &head : free_lists)
+            head = NULL;
+        current = 0;
+        used = 0;
+        resets++;
+    }
+};
+
+/*
+ * A standard allocator over the current arena, or over the heap when there
+ * isn't one, so containers use it without carrying a pointer around.
+ */
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    ArenaAllocator ()
+    { }
+
+    template <typename U>
+    ArenaAllocator (const ArenaAllocator<U> &)
+    { }
+
+    T *
+    allocate (size_t n)
+    {
+        if (ARENA)
+            return static_cast<T *>(ARENA->allocate(n * sizeof(T)));
+        return static_cast<T *>(Arena::heap_piece(n * sizeof(T)));
+    }
+
+    void
+    deallocate (T *p, size_t)
+    {
+        Arena::release(p);
+    }
+
+    template <typename U>
+    bool
+    operator== (const ArenaAllocator<U> &) const
+    {
+        return true;
+    }
+
+    template <typename U>
+    bool
+    operator!= (const ArenaAllocator<U> &) const
+    {
+        return false;
+    }
+};
+
+#endif
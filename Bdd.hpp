@@ -0,0 +1,803 @@
+#ifndef BDD_HPP
+#define BDD_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+#include "Node.hpp"
+#include "Store.hpp"
+#include "Cube.hpp"
+
+/*
+ * An edge to a BDD vertex: the vertex's index shifted left once with the low
+ * bit set when the edge is complemented, i.e. the function is the negation of
+ * the vertex's. Vertex 0 is the constant 1 so the edge 0 is true and 1 is
+ * false.
+ */
+typedef uint32_t BddId;
+
+static const BddId BDD_TRUE = 0;
+static const BddId BDD_FALSE = 1;
+
+static const uint32_t NO_VERTEX = UINT32_MAX;
+/* the variable of the terminal vertex, which sits below every level */
+static const uint32_t TERMINAL_VAR = UINT32_MAX;
+/* the variable of a vertex on the free list */
+static const uint32_t FREE_VAR = UINT32_MAX - 1;
+
+/* the live vertices past which reordering starts by default */
+static const size_t BDD_REORDER_THRESHOLD = 1 << 14;
+
+/* sifting a variable gives up on a direction once the BDD grows by this */
+static const double BDD_MAX_GROWTH = 1.2;
+
+/*
+ * A reduced ordered BDD package. Every vertex is unique for its variable and
+ * children so two functions are equal exactly when their edges are equal.
+ *
+ * Complement edges mean f and !f share every vertex and negation is free. To
+ * keep that canonical the high (variable = 1) edge of a vertex is never
+ * complemented; a vertex which would have one is stored as the complement of
+ * the vertex with both edges flipped.
+ *
+ * Variables are tested in the order of their levels, which start out as the
+ * variable indices, i.e. alphabetical order. Since the size of a BDD depends
+ * so much on the order, `set_order' can give another one before anything is
+ * built and `reorder' sifts the variables of what has been built into a
+ * better one. Sifting happens on its own once the number of live vertices
+ * passes `reorder_threshold'.
+ *
+ * Vertices are reference counted: one count for each vertex above them and
+ * one for each `ref' of the functions which are being kept. Anything else,
+ * e.g. the intermediate results of ITE, is garbage the next time reordering
+ * collects it. The functions returned by `build' are already referenced.
+ */
+struct Bdd {
+    struct Vertex {
+        uint32_t var;
+        BddId low;
+        BddId high;
+        /* the next vertex in the same unique table bucket or free list */
+        uint32_t next;
+        uint32_t ref;
+    };
+
+    /* the vertices of a single variable, chained in power of two buckets */
+    struct Subtable {
+        std::vector<uint32_t> buckets;
+        size_t count;
+
+        Subtable ()
+            : buckets(16, NO_VERTEX)
+            , count(0)
+        { }
+    };
+
+    /* a computed table entry: ITE(f, g, h) = result */
+    struct Computed {
+        BddId f, g, h;
+        BddId result;
+    };
+
+    std::vector<Vertex> vertices;
+    std::vector<Subtable> subtables;
+    /* the level of each variable, and the variable at each level */
+    std::vector<uint32_t> level;
+    std::vector<uint32_t> var_at;
+    /*
+     * The computed table is lossy: an entry is a single slot which a later
+     * result for a different ITE with the same hash simply overwrites.
+     */
+    std::vector<Computed> cache;
+    /* the vertices freed by garbage collection, for `make' to reuse */
+    uint32_t free_list;
+    size_t live;
+
+    /* sift once there are this many live vertices, 0 to never do so */
+    size_t reorder_threshold;
+    /* the live vertices before and after each reordering */
+    std::vector<std::pair<size_t, size_t>> reorderings;
+
+    Bdd ()
+        : cache(1 << 16, Computed{ BDD_FALSE, BDD_FALSE, BDD_FALSE, BDD_FALSE })
+        , free_list(NO_VERTEX)
+        , live(1)
+        , reorder_threshold(BDD_REORDER_THRESHOLD)
+    {
+        vertices.push_back(Vertex{ TERMINAL_VAR, BDD_TRUE, BDD_TRUE,
+                                   NO_VERTEX, 0 });
+    }
+
+    static bool
+    complemented (BddId e)
+    {
+        return e & 1;
+    }
+
+    static BddId
+    regular (BddId e)
+    {
+        return e & ~1u;
+    }
+
+    static BddId
+    negate (BddId e)
+    {
+        return e ^ 1;
+    }
+
+    static bool
+    constant (BddId e)
+    {
+        return (e >> 1) == 0;
+    }
+
+    uint32_t
+    var (BddId e) const
+    {
+        return vertices[e >> 1].var;
+    }
+
+    uint32_t
+    level_of (BddId e) const
+    {
+        if (constant(e))
+            return UINT32_MAX;
+        return level[var(e)];
+    }
+
+    /* the cofactors of e with its top variable 0 and 1 */
+    BddId
+    low (BddId e) const
+    {
+        return vertices[e >> 1].low ^ (e & 1);
+    }
+
+    BddId
+    high (BddId e) const
+    {
+        return vertices[e >> 1].high ^ (e & 1);
+    }
+
+    /* the number of live vertices, including the terminal */
+    size_t
+    count () const
+    {
+        return live;
+    }
+
+    /* keep the function e when garbage is collected */
+    void
+    ref (BddId e)
+    {
+        if (!constant(e))
+            vertices[e >> 1].ref++;
+    }
+
+    /* stop keeping e, which is collected later if nothing else keeps it */
+    void
+    deref (BddId e)
+    {
+        if (constant(e))
+            return;
+        assert(vertices[e >> 1].ref > 0);
+        vertices[e >> 1].ref--;
+    }
+
+    /* new variables are put below every existing level */
+    void
+    add_var (uint32_t v)
+    {
+        while (subtables.size() <= v) {
+            level.push_back(var_at.size());
+            var_at.push_back(subtables.size());
+            subtables.push_back(Subtable());
+        }
+    }
+
+    /*
+     * Put the variables `order' at the top levels in that order and the rest
+     * below them by index. Only before anything has been built.
+     */
+    void
+    set_order (const std::vector<uint32_t> &order)
+    {
+        std::vector<bool> placed;
+        uint32_t top = 0;
+
+        assert(live == 1);
+        for (auto v : order)
+            add_var(v);
+        placed.assign(subtables.size(), false);
+
+        for (auto v : order) {
+            if (placed[v])
+                continue;
+            placed[v] = true;
+            var_at[top++] = v;
+        }
+        for (uint32_t v = 0; v < subtables.size(); v++)
+            if (!placed[v])
+                var_at[top++] = v;
+        for (uint32_t l = 0; l < var_at.size(); l++)
+            level[var_at[l]] = l;
+    }
+
+    /* the function which is just the variable v */
+    BddId
+    make_var (uint32_t v)
+    {
+        return make(v, BDD_FALSE, BDD_TRUE);
+    }
+
+    /* the vertex testing v with the given cofactors */
+    BddId
+    make (uint32_t v, BddId low, BddId high)
+    {
+        if (low == high)
+            return low;
+        if (complemented(high))
+            return negate(make(v, negate(low), negate(high)));
+
+        add_var(v);
+        Subtable &T = subtables[v];
+        size_t b = bucket(low, high, T.buckets.size());
+
+        for (uint32_t i = T.buckets[b]; i != NO_VERTEX; i = vertices[i].next)
+            if (vertices[i].low == low && vertices[i].high == high)
+                return i << 1;
+
+        uint32_t i = free_list;
+        Vertex V{ v, low, high, NO_VERTEX, 0 };
+        if (i == NO_VERTEX) {
+            i = vertices.size();
+            vertices.push_back(V);
+        } else {
+            free_list = vertices[i].next;
+            vertices[i] = V;
+        }
+        ref(low);
+        ref(high);
+        insert(i);
+        grow_cache();
+        return i << 1;
+    }
+
+    /*
+     * If-then-else: (f and g) or (!f and h). Every other operation is one of
+     * these. The arguments are first put in a standard form, so the many ways
+     * of writing the same ITE share a cache entry, with f and g regular.
+     */
+    BddId
+    ite (BddId f, BddId g, BddId h)
+    {
+        bool negated = false;
+        BddId result;
+
+        if (f == BDD_TRUE)
+            return g;
+        if (f == BDD_FALSE)
+            return h;
+        if (g == h)
+            return g;
+
+        if (g == f)
+            g = BDD_TRUE;
+        else if (g == negate(f))
+            g = BDD_FALSE;
+        if (h == f)
+            h = BDD_FALSE;
+        else if (h == negate(f))
+            h = BDD_TRUE;
+
+        if (g == BDD_TRUE && h == BDD_FALSE)
+            return f;
+        if (g == BDD_FALSE && h == BDD_TRUE)
+            return negate(f);
+
+        if (complemented(f)) {
+            f = negate(f);
+            std::swap(g, h);
+        }
+        if (complemented(g)) {
+            g = negate(g);
+            h = negate(h);
+            negated = true;
+        }
+
+        Computed &C = cache[cache_slot(f, g, h)];
+        if (C.f == f && C.g == g && C.h == h)
+            return C.result ^ negated;
+
+        uint32_t top = std::min(level_of(f), std::min(level_of(g),
+                                                      level_of(h)));
+        uint32_t v = var_at[top];
+        BddId low = ite(cofactor(f, top, false), cofactor(g, top, false),
+                        cofactor(h, top, false));
+        BddId high = ite(cofactor(f, top, true), cofactor(g, top, true),
+                         cofactor(h, top, true));
+        result = make(v, low, high);
+
+        /* the reference may have moved when the cache grew */
+        Computed &D = cache[cache_slot(f, g, h)];
+        D.f = f;
+        D.g = g;
+        D.h = h;
+        D.result = result;
+        return result ^ negated;
+    }
+
+    BddId
+    apply_and (BddId f, BddId g)
+    {
+        return ite(f, g, BDD_FALSE);
+    }
+
+    BddId
+    apply_or (BddId f, BddId g)
+    {
+        return ite(f, BDD_TRUE, g);
+    }
+
+    /*
+     * Build the BDD of a parsed expression. The result is referenced.
+     */
+    BddId
+    build (const Node &N)
+    {
+        BddId result;
+
+        switch (N.type) {
+            case TRUE:
+                return BDD_TRUE;
+            case FALSE:
+                return BDD_FALSE;
+            case VAR:
+                result = make_var(N.var);
+                ref(result);
+                return N.negated ? negate(result) : result;
+            case NOT:
+                return negate(build(*N.children.begin()));
+            default:
+                result = (N.type == AND) ? BDD_TRUE : BDD_FALSE;
+                for (auto &child : N.children) {
+                    BddId c = build(child);
+                    result = combine(N.type, result, c);
+                    deref(c);
+                }
+                return result;
+        }
+    }
+
+    /*
+     * Build the BDD of an expression in the store. Shared subexpressions are
+     * built once. The result is referenced.
+     */
+    BddId
+    build (const Store &S, NodeId N)
+    {
+        std::vector<BddId> built(S.count(), NO_VERTEX);
+        BddId result = build(S, N, built);
+
+        ref(result);
+        for (auto e : built)
+            if (e != NO_VERTEX)
+                deref(e);
+        return result;
+    }
+
+    /*
+     * Sift every variable, largest subtable first: move it through every
+     * level and leave it where the BDD was smallest. Garbage is collected
+     * first so only the referenced functions count. Returns the number of
+     * live vertices before and after.
+     */
+    std::pair<size_t, size_t>
+    reorder ()
+    {
+        std::vector<uint32_t> vars;
+        size_t before;
+
+        collect();
+        before = live;
+
+        for (uint32_t v = 0; v < subtables.size(); v++)
+            if (subtables[v].count > 0)
+                vars.push_back(v);
+        std::stable_sort(vars.begin(), vars.end(), [&](uint32_t a, uint32_t b) {
+            return subtables[a].count > subtables[b].count;
+        });
+
+        for (auto v : vars)
+            sift(v);
+
+        /* the cached results are still right but may name freed vertices */
+        std::fill(cache.begin(), cache.end(),
+                  Computed{ BDD_FALSE, BDD_FALSE, BDD_FALSE, BDD_FALSE });
+        reorderings.push_back(std::make_pair(before, live));
+        return reorderings.back();
+    }
+
+    /*
+     * Free every vertex no referenced function uses. Any function which
+     * wasn't referenced is no longer valid.
+     */
+    void
+    collect ()
+    {
+        std::vector<uint32_t> dead;
+
+        for (auto &T : subtables)
+            for (auto head : T.buckets)
+                for (uint32_t i = head; i != NO_VERTEX; i = vertices[i].next)
+                    if (vertices[i].ref == 0)
+                        dead.push_back(i);
+        for (auto i : dead)
+            release(i);
+        std::fill(cache.begin(), cache.end(),
+                  Computed{ BDD_FALSE, BDD_FALSE, BDD_FALSE, BDD_FALSE });
+    }
+
+    /* the number of vertices of f, including the terminal */
+    size_t
+    size (BddId f) const
+    {
+        std::vector<bool> seen(vertices.size(), false);
+        std::vector<uint32_t> stack(1, f >> 1);
+        size_t n = 0;
+
+        while (!stack.empty()) {
+            uint32_t i = stack.back();
+            stack.pop_back();
+            if (seen[i])
+                continue;
+            seen[i] = true;
+            n++;
+            if (i != 0) {
+                stack.push_back(vertices[i].low >> 1);
+                stack.push_back(vertices[i].high >> 1);
+            }
+        }
+        return n;
+    }
+
+    /*
+     * The DNF with a term for every path from f to true. The paths are
+     * disjoint so this is a canonical form for the variable order, but the
+     * number of paths can be exponential in the size of the BDD.
+     */
+    Cover
+    paths (BddId f) const
+    {
+        Cover C(OR);
+        Cube path;
+        paths(f, path, C);
+        C.canonical();
+        return C;
+    }
+
+    void
+    clear ()
+    {
+        vertices.resize(1);
+        for (auto &T : subtables)
+            T = Subtable();
+        free_list = NO_VERTEX;
+        live = 1;
+        std::fill(cache.begin(), cache.end(),
+                  Computed{ BDD_FALSE, BDD_FALSE, BDD_FALSE, BDD_FALSE });
+    }
+
+private:
+    static size_t
+    bucket (BddId low, BddId high, size_t size)
+    {
+        uint64_t h = ((uint64_t) low << 32 | high) * 0x9e3779b97f4a7c15ULL;
+        return (h >> 32) & (size - 1);
+    }
+
+    size_t
+    cache_slot (BddId f, BddId g, BddId h) const
+    {
+        uint64_t k = f * 0x9e3779b97f4a7c15ULL;
+        k ^= (g + 0x632be59bd9b4e019ULL) * 0xbf58476d1ce4e5b9ULL;
+        k ^= (h + 0x85ebca77c2b2ae63ULL) * 0x94d049bb133111ebULL;
+        return (k ^ (k >> 31)) & (cache.size() - 1);
+    }
+
+    void
+    insert (uint32_t i)
+    {
+        Subtable &T = subtables[vertices[i].var];
+        size_t b = bucket(vertices[i].low, vertices[i].high, T.buckets.size());
+
+        vertices[i].next = T.buckets[b];
+        T.buckets[b] = i;
+        T.count++;
+        live++;
+        if (T.count > T.buckets.size())
+            rehash(vertices[i].var);
+    }
+
+    void
+    unlink (uint32_t i)
+    {
+        Subtable &T = subtables[vertices[i].var];
+        size_t b = bucket(vertices[i].low, vertices[i].high, T.buckets.size());
+        uint32_t *at = &T.buckets[b];
+
+        while (*at != i)
+            at = &vertices[*at].next;
+        *at = vertices[i].next;
+        T.count--;
+        live--;
+    }
+
+    /*
+     * Drop a reference from the vertex i and free it, and so on down through
+     * its children, once nothing refers to it.
+     */
+    void
+    release (uint32_t i)
+    {
+        std::vector<uint32_t> stack(1, i);
+
+        while (!stack.empty()) {
+            i = stack.back();
+            stack.pop_back();
+            if (i == 0)
+                continue;
+            if (vertices[i].var == FREE_VAR)
+                continue;
+            if (vertices[i].ref > 0 && --vertices[i].ref > 0)
+                continue;
+            unlink(i);
+            stack.push_back(vertices[i].low >> 1);
+            stack.push_back(vertices[i].high >> 1);
+            vertices[i].var = FREE_VAR;
+            vertices[i].next = free_list;
+            free_list = i;
+        }
+    }
+
+    /*
+     * AND or OR two referenced functions, reference the result and drop the
+     * reference to f. With no intermediate results of ITE around this is
+     * where reordering can happen.
+     */
+    BddId
+    combine (NodeType type, BddId f, BddId g)
+    {
+        BddId result = (type == AND) ? apply_and(f, g) : apply_or(f, g);
+
+        ref(result);
+        deref(f);
+        if (reorder_threshold > 0 && live > reorder_threshold) {
+            reorder();
+            reorder_threshold = std::max(reorder_threshold, 2 * live);
+        }
+        return result;
+    }
+
+    /*
+     * Swap the variables at levels l and l + 1 in place. Every vertex keeps
+     * its function, so every edge anyone holds stays valid: a vertex of the
+     * upper variable x with a child testing the lower variable y becomes a
+     * vertex of y whose children test x, the rest stay as they are.
+     */
+    void
+    swap (uint32_t l)
+    {
+        uint32_t x = var_at[l], y = var_at[l + 1];
+        std::vector<uint32_t> xs, movers;
+
+        for (auto head : subtables[x].buckets)
+            for (uint32_t i = head; i != NO_VERTEX; i = vertices[i].next)
+                xs.push_back(i);
+        for (auto i : xs) {
+            BddId low = vertices[i].low, high = vertices[i].high;
+            if ((!constant(low) && var(low) == y) ||
+                (!constant(high) && var(high) == y)) {
+                unlink(i);
+                movers.push_back(i);
+            }
+        }
+
+        var_at[l] = y;
+        var_at[l + 1] = x;
+        level[y] = l;
+        level[x] = l + 1;
+
+        for (auto i : movers) {
+            BddId f0 = vertices[i].low, f1 = vertices[i].high;
+            BddId f00 = f0, f01 = f0, f10 = f1, f11 = f1;
+
+            if (!constant(f0) && var(f0) == y) {
+                f00 = low(f0);
+                f01 = high(f0);
+            }
+            if (!constant(f1) && var(f1) == y) {
+                f10 = low(f1);
+                f11 = high(f1);
+            }
+
+            /* f11 is regular since f1 is, so the new high edge is too */
+            BddId high = make(x, f01, f11);
+            BddId low = make(x, f00, f10);
+            ref(high);
+            ref(low);
+            vertices[i].var = y;
+            vertices[i].low = low;
+            vertices[i].high = high;
+            insert(i);
+            if (!constant(f0))
+                release(f0 >> 1);
+            if (!constant(f1))
+                release(f1 >> 1);
+        }
+    }
+
+    /*
+     * Move the variable v through the levels, down then up or up then down
+     * whichever end is nearer, and back to wherever there were the fewest
+     * live vertices. A direction is given up once the BDD grows past
+     * BDD_MAX_GROWTH times the best so far.
+     */
+    void
+    sift (uint32_t v)
+    {
+        uint32_t last = var_at.size() - 1;
+        uint32_t best_level = level[v];
+        size_t best = live;
+        bool down_first = level[v] > last / 2 ? false : true;
+
+        for (int pass = 0; pass < 2; pass++) {
+            bool down = (pass == 0) == down_first;
+            while (down ? level[v] < last : level[v] > 0) {
+                swap(down ? level[v] : level[v] - 1);
+                if (live < best) {
+                    best = live;
+                    best_level = level[v];
+                }
+                if (live > best * BDD_MAX_GROWTH)
+                    break;
+            }
+        }
+
+        while (level[v] < best_level)
+            swap(level[v]);
+        while (level[v] > best_level)
+            swap(level[v] - 1);
+    }
+
+    void
+    rehash (uint32_t v)
+    {
+        Subtable &T = subtables[v];
+        std::vector<uint32_t> old;
+
+        old.swap(T.buckets);
+        T.buckets.assign(old.size() * 2, NO_VERTEX);
+        for (auto head : old) {
+            for (uint32_t i = head, next; i != NO_VERTEX; i = next) {
+                size_t b = bucket(vertices[i].low, vertices[i].high,
+                                  T.buckets.size());
+                next = vertices[i].next;
+                vertices[i].next = T.buckets[b];
+                T.buckets[b] = i;
+            }
+        }
+    }
+
+    /*
+     * Keep the cache about as large as the number of vertices, up to a limit.
+     * The old entries are dropped.
+     */
+    void
+    grow_cache ()
+    {
+        if (vertices.size() <= cache.size() || cache.size() >= (1 << 22))
+            return;
+        cache.assign(cache.size() * 2,
+                     Computed{ BDD_FALSE, BDD_FALSE, BDD_FALSE, BDD_FALSE });
+    }
+
+    /* e with the variable at `top' fixed, if e tests it at all */
+    BddId
+    cofactor (BddId e, uint32_t top, bool value) const
+    {
+        if (level_of(e) != top)
+            return e;
+        return value ? high(e) : low(e);
+    }
+
+    BddId
+    build (const Store &S, NodeId N, std::vector<BddId> &built)
+    {
+        BddId result;
+
+        if (built[N] != NO_VERTEX)
+            return built[N];
+
+        switch (S.type(N)) {
+            case TRUE:
+                result = BDD_TRUE;
+                break;
+            case FALSE:
+                result = BDD_FALSE;
+                break;
+            case VAR:
+                result = make_var(S.var(N));
+                if (S.negated(N))
+                    result = negate(result);
+                ref(result);
+                break;
+            case NOT:
+                result = negate(build(S, S.child(N, 0), built));
+                ref(result);
+                break;
+            default:
+                /* the results in `built' are referenced until the end */
+                result = (S.type(N) == AND) ? BDD_TRUE : BDD_FALSE;
+                for (size_t i = 0; i < S.size(N); i++)
+                    result = combine(S.type(N), result,
+                                     build(S, S.child(N, i), built));
+                break;
+        }
+
+        built[N] = result;
+        return result;
+    }
+
+    void
+    paths (BddId f, Cube &path, Cover &C) const
+    {
+        if (f == BDD_FALSE)
+            return;
+        if (f == BDD_TRUE) {
+            C.add(path);
+            return;
+        }
+
+        uint32_t v = var(f);
+        Cube with = path;
+        with.add(v, true);
+        paths(low(f), with, C);
+        with = path;
+        with.add(v, false);
+        paths(high(f), with, C);
+    }
+};
+
+/*
+ * A static variable order: the variables in the order a depth first walk of
+ * the expression first meets them. Variables used together in a
+ * subexpression end up close together, which is what keeps a BDD small.
+ */
+std::vector<uint32_t>
+dfs_order (const Node &N)
+{
+    std::vector<uint32_t> order;
+    std::vector<bool> seen;
+    std::vector<const Node *> stack(1, &N);
+
+    while (!stack.empty()) {
+        const Node *M = stack.back();
+        stack.pop_back();
+        if (M->type == VAR) {
+            if (M->var >= seen.size())
+                seen.resize(M->var + 1, false);
+            if (!seen[M->var]) {
+                seen[M->var] = true;
+                order.push_back(M->var);
+            }
+        }
+        /* pushed in reverse so the first child is walked first */
+        for (auto it = M->children.rbegin(); it != M->children.rend(); it++)
+            stack.push_back(&*it);
+    }
+    return order;
+}
+
+#endif
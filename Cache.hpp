@@ -0,0 +1,128 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <cstdint>
+#include "Node.hpp"
+#include "Cube.hpp"
+
+/* the cubes the cache holds at most before it lets the oldest go */
+static const size_t CACHE_CUBES = 1 << 20;
+
+/*
+ * The covers which subtrees converted to, so that a subtree met again, in the
+ * same expression or in another one, isn't converted again. A subtree is
+ * known by a structural hash of 128 bits which doesn't depend on the ids of
+ * any store, so the stores of a batch can share one cache, and by the form
+ * it was converted to. Along with the hash each entry keeps the number of
+ * nodes in its subtree and a mask of the variables in it, which a lookup
+ * has to match too, so a subtree whose hash collides with another's is
+ * only taken for it if it is also as big and over the same variables.
+ *
+ * The covers use the ids of the variables and nothing else, so it doesn't
+ * matter which names a symbol table gives them. The least recently used are
+ * dropped once the cache holds more than `capacity' cubes. It locks around
+ * every lookup so any number of threads can use it.
+ */
+struct ConversionCache {
+    struct Key {
+        uint64_t first;
+        uint64_t second;
+        NodeType form;
+        /* the check: nodes counting shared ones each time, variables mod 64 */
+        uint32_t nodes;
+        uint64_t support;
+
+        bool
+        operator== (const Key &other) const
+        {
+            return first == other.first && second == other.second &&
+                   form == other.form && nodes == other.nodes &&
+                   support == other.support;
+        }
+    };
+
+    struct KeyHash {
+        size_t
+        operator() (const Key &key) const
+        {
+            return key.first ^ key.form;
+        }
+    };
+
+    typedef std::list<std::pair<Key, Cover>> Entries;
+
+    std::mutex lock;
+    /* the most recently used first */
+    Entries entries;
+    std::unordered_map<Key, Entries::iterator, KeyHash> index;
+    size_t capacity;
+    /* the cubes held, counting each entry as one more so empty covers count */
+    size_t cubes;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+
+    ConversionCache (size_t capacity = CACHE_CUBES)
+        : capacity(capacity)
+        , cubes(0)
+        , hits(0)
+        , misses(0)
+        , evictions(0)
+    { }
+
+    bool
+    find (const Key &key, Cover &cover)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = index.find(key);
+
+        if (found == index.end()) {
+            misses++;
+            return false;
+        }
+        entries.splice(entries.begin(), entries, found->second);
+        cover = found->second->second;
+        hits++;
+        return true;
+    }
+
+    void
+    insert (const Key &key, const Cover &cover)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        /* another thread may have converted the same subtree meanwhile */
+        if (index.count(key) || cover.cubes.size() + 1 > capacity)
+            return;
+        entries.emplace_front(key, cover);
+        index[key] = entries.begin();
+        cubes += cover.cubes.size() + 1;
+
+        while (cubes > capacity) {
+            cubes -= entries.back().second.cubes.size() + 1;
+            index.erase(entries.back().first);
+            entries.pop_back();
+            evictions++;
+        }
+    }
+
+    size_t
+    size ()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return entries.size();
+    }
+};
+
+/*
+ * The cache the conversions use, if any. Unlike most of the state here it is
+ * one for every thread, so the workers of a batch share what they convert.
+ */
+static ConversionCache *CONVERSION_CACHE = NULL;
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef CUBE_HPP
+#define CUBE_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "Node.hpp"
+#include "Store.hpp"
+
+/*
+ * A set of literals kept as two bitsets: bit v of `pos' is the literal v and
+ * bit v of `neg' is the literal !v. Whether the literals are ANDed (a term
+ * of a DNF) or ORed (a clause of a CNF) is up to the Cover holding it; the
+ * set operations are the same either way.
+ *
+ * The masks are words of 64 variables and grow as larger variables are
+ * added, so most cubes are a single word each.
+ */
+struct Cube {
+    std::vector<uint64_t> pos;
+    std::vector<uint64_t> neg;
+
+    Cube ()
+        : pos(1, 0)
+        , neg(1, 0)
+    { }
+
+    size_t
+    words () const
+    {
+        return pos.size();
+    }
+
+    void
+    widen (size_t words)
+    {
+        if (words <= this->words())
+            return;
+        pos.resize(words, 0);
+        neg.resize(words, 0);
+    }
+
+    void
+    add (uint32_t var, bool negated)
+    {
+        widen(var / 64 + 1);
+        if (negated)
+            neg[var / 64] |= 1ULL << (var % 64);
+        else
+            pos[var / 64] |= 1ULL << (var % 64);
+    }
+
+    bool
+    has (uint32_t var, bool negated) const
+    {
+        if (var / 64 >= words())
+            return false;
+        if (negated)
+            return (neg[var / 64] >> (var % 64)) & 1;
+        return (pos[var / 64] >> (var % 64)) & 1;
+    }
+
+    /* add every literal of `other' to this cube */
+    void
+    join (const Cube &other)
+    {
+        widen(other.words());
+        for (size_t i = 0; i < other.words(); i++) {
+            pos[i] |= other.pos[i];
+            neg[i] |= other.neg[i];
+        }
+    }
+
+    /* does the cube hold both x and !x for some x */
+    bool
+    contradicts () const
+    {
+        for (size_t i = 0; i < words(); i++)
+            if (pos[i] & neg[i])
+                return true;
+        return false;
+    }
+
+    /* is every literal of `other' also in this cube */
+    bool
+    contains (const Cube &other) const
+    {
+        for (size_t i = 0; i < other.words(); i++) {
+            uint64_t p = i < words() ? pos[i] : 0;
+            uint64_t n = i < words() ? neg[i] : 0;
+            if ((other.pos[i] & ~p) || (other.neg[i] & ~n))
+                return false;
+        }
+        return true;
+    }
+
+    /*
+     * A bit for each literal folded into one word: x sets bit x % 64 and !x
+     * sets bit (x + 32) % 64. A cube can only contain another if it has every
+     * bit of the other's signature, so most pairs are told apart by one AND.
+     */
+    uint64_t
+    signature () const
+    {
+        uint64_t sig = 0;
+        for (size_t i = 0; i < words(); i++)
+            sig |= pos[i] | (neg[i] << 32) | (neg[i] >> 32);
+        return sig;
+    }
+
+    /* the literals of the cube as var << 1 | negated, in order */
+    void
+    literals (std::vector<uint32_t> &out) const
+    {
+        out.clear();
+        for (size_t w = 0; w < words(); w++) {
+            for (uint64_t m = pos[w] | neg[w]; m; m &= m - 1) {
+                uint32_t var = w * 64 + __builtin_ctzll(m);
+                if (has(var, false))
+                    out.push_back(var << 1);
+                if (has(var, true))
+                    out.push_back((var << 1) | 1);
+            }
+        }
+    }
+
+    /* number of literals */
+    size_t
+    size () const
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < words(); i++)
+            n += __builtin_popcountll(pos[i]) + __builtin_popcountll(neg[i]);
+        return n;
+    }
+
+    bool
+    operator== (const Cube &other) const
+    {
+        return pos == other.pos && neg == other.neg;
+    }
+
+    bool
+    operator< (const Cube &other) const
+    {
+        if (pos != other.pos)
+            return pos < other.pos;
+        return neg < other.neg;
+    }
+};
+
+/*
+ * A two-level expression: a sum of products when `type' is OR, a product of
+ * sums when `type' is AND. An empty cover is the identity of its type (0 for
+ * a sum, 1 for a product) and an empty cube is the identity of the other type.
+ */
+struct Cover {
+    NodeType type;
+    std::vector<Cube> cubes;
+
+    Cover (NodeType type = OR)
+        : type(type)
+    { }
+
+    /* the type of each cube, i.e. AND for the terms of a DNF */
+    NodeType
+    cube_type () const
+    {
+        return type == OR ? AND : OR;
+    }
+
+    void
+    add (const Cube &C)
+    {
+        cubes.push_back(C);
+    }
+
+    /* make every cube the same width */
+    void
+    widen ()
+    {
+        size_t words = 1;
+        for (auto &C : cubes)
+            words = std::max(words, C.words());
+        for (auto &C : cubes)
+            C.widen(words);
+    }
+
+    /* sort the cubes and drop duplicates */
+    void
+    canonical ()
+    {
+        widen();
+        std::sort(cubes.begin(), cubes.end());
+        cubes.erase(std::unique(cubes.begin(), cubes.end()), cubes.end());
+    }
+};
+
+/*
+ * Add the literal or constant `N' to the cube C of `cube_type'. A constant
+ * that is the identity of the cube's type is dropped and one that dominates
+ * it makes the cube trivial, which is reported by returning true.
+ */
+bool
+add_literal (const Store &S, NodeId N, NodeType cube_type, Cube &C)
+{
+    switch (S.type(N)) {
+        case VAR:
+            C.add(S.var(N), S.negated(N));
+            return false;
+        case TRUE:
+            return cube_type == OR;
+        case FALSE:
+            return cube_type == AND;
+        default:
+            break;
+    }
+    return false;
+}
+
+/*
+ * Build the cover of type `type' from the store if N is already in that
+ * two-level form (this is what is_cnf and is_dnf ask), otherwise return false.
+ * Cubes made trivial by a constant are dropped here. A constant on its own is
+ * a cube which is either empty or trivial.
+ */
+bool
+to_cover (const Store &S, NodeId N, NodeType type, Cover &cover)
+{
+    NodeType cube_type = (type == OR) ? AND : OR;
+    std::vector<NodeId> cubes;
+
+    cover = Cover(type);
+
+    if (S.type(N) == type) {
+        for (size_t i = 0; i < S.size(N); i++)
+            cubes.push_back(S.child(N, i));
+    } else {
+        cubes.push_back(N);
+    }
+
+    for (auto c : cubes) {
+        Cube C;
+        bool trivial = false;
+
+        if (S.type(c) == NOT || S.type(c) == type) {
+            return false;
+        } else if (S.type(c) == cube_type) {
+            for (size_t i = 0; i < S.size(c); i++) {
+                NodeId l = S.child(c, i);
+                if (S.is_operator(l))
+                    return false;
+                trivial = trivial || add_literal(S, l, cube_type, C);
+            }
+        } else {
+            /* a single literal is a cube of one */
+            trivial = add_literal(S, c, cube_type, C);
+        }
+
+        if (!trivial)
+            cover.add(C);
+    }
+
+    cover.widen();
+    return true;
+}
+
+/*
+ * Put the cover back into the store.
+ */
+NodeId
+from_cover (Store &S, const Cover &cover)
+{
+    NodeType cube_type = cover.cube_type();
+    std::vector<NodeId> cubes;
+
+    for (auto &C : cover.cubes) {
+        std::vector<NodeId> literals;
+        for (size_t w = 0; w < C.words(); w++) {
+            for (uint64_t m = C.pos[w] | C.neg[w]; m; m &= m - 1) {
+                uint32_t var = w * 64 + __builtin_ctzll(m);
+                if (C.has(var, true))
+                    literals.push_back(S.make_var(var, true));
+                if (C.has(var, false))
+                    literals.push_back(S.make_var(var, false));
+            }
+        }
+        /* an empty cube is the identity of its type */
+        if (literals.empty())
+            cubes.push_back(S.make(cube_type == AND ? TRUE : FALSE));
+        else if (literals.size() == 1)
+            cubes.push_back(literals[0]);
+        else
+            cubes.push_back(S.make(cube_type, literals));
+    }
+
+    if (cubes.empty())
+        return S.make(cover.type == AND ? TRUE : FALSE);
+    if (cubes.size() == 1)
+        return cubes[0];
+    return S.make(cover.type, cubes);
+}
+
+#endif
@@ -0,0 +1,411 @@
+#ifndef ESPRESSO_HPP
+#define ESPRESSO_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "Node.hpp"
+#include "Cube.hpp"
+
+/*
+ * Covers with at least this many cubes are minimized with espresso rather
+ * than only having their contained cubes filtered out.
+ */
+static const size_t ESPRESSO_MIN_CUBES = 16;
+
+/* the number of REDUCE/EXPAND/IRREDUNDANT passes made by default */
+static const unsigned ESPRESSO_ITERATIONS = 4;
+
+/*
+ * The terms of a sum of products, flattened into one array so the cofactors
+ * which the tautology checks make by the thousand are a single allocation
+ * rather than two per cube. Each term is `words' words of positive literals
+ * followed by `words' words of negative ones, laid out like a Cube. An empty
+ * term is 1.
+ *
+ * A product of sums is minimized as the sum of products of its complement,
+ * see `espresso'.
+ */
+struct Terms {
+    size_t words;
+    std::vector<uint64_t> bits;
+
+    Terms (size_t words)
+        : words(words)
+    { }
+
+    size_t
+    size () const
+    {
+        return bits.size() / (2 * words);
+    }
+
+    uint64_t *
+    term (size_t i)
+    {
+        return &bits[i * 2 * words];
+    }
+
+    const uint64_t *
+    term (size_t i) const
+    {
+        return &bits[i * 2 * words];
+    }
+
+    void
+    add (const uint64_t *t)
+    {
+        bits.insert(bits.end(), t, t + 2 * words);
+    }
+
+    size_t
+    literals (size_t i) const
+    {
+        size_t n = 0;
+        for (size_t w = 0; w < 2 * words; w++)
+            n += __builtin_popcountll(term(i)[w]);
+        return n;
+    }
+
+    /* reorder the terms as `order', leaving out those marked in `gone' */
+    void
+    select (const std::vector<size_t> &order, const std::vector<bool> &gone)
+    {
+        std::vector<uint64_t> kept;
+        kept.reserve(bits.size());
+        for (auto i : order)
+            if (!gone[i])
+                kept.insert(kept.end(), term(i), term(i) + 2 * words);
+        bits.swap(kept);
+    }
+
+    /* order the terms by their number of literals */
+    void
+    sort (bool fewest_first)
+    {
+        std::vector<size_t> order(size()), count(size());
+        for (size_t i = 0; i < size(); i++) {
+            order[i] = i;
+            count[i] = literals(i);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return fewest_first ? count[a] < count[b] : count[a] > count[b];
+        });
+        select(order, std::vector<bool>(size(), false));
+    }
+};
+
+/* do the terms a and b share an assignment (no x in one and !x in the other) */
+bool
+intersects (const uint64_t *a, const uint64_t *b, size_t words)
+{
+    for (size_t w = 0; w < words; w++)
+        if ((a[w] & b[words + w]) || (a[words + w] & b[w]))
+            return false;
+    return true;
+}
+
+/* is the term a inside the term b, i.e. does a have every literal of b */
+bool
+inside (const uint64_t *a, const uint64_t *b, size_t words)
+{
+    for (size_t w = 0; w < 2 * words; w++)
+        if (b[w] & ~a[w])
+            return false;
+    return true;
+}
+
+/*
+ * The cofactor of F by c: the terms of F which intersect c with the literals
+ * of c removed. F covers c exactly when its cofactor by c is a tautology.
+ * Terms marked in `skip' are left out.
+ */
+Terms
+cofactor (const Terms &F,
+          const uint64_t *c,
+          const std::vector<bool> *skip = NULL)
+{
+    Terms G(F.words);
+
+    for (size_t i = 0; i < F.size(); i++) {
+        if ((skip && (*skip)[i]) || !intersects(F.term(i), c, F.words))
+            continue;
+        G.add(F.term(i));
+        uint64_t *t = G.term(G.size() - 1);
+        for (size_t w = 0; w < 2 * F.words; w++)
+            t[w] &= ~c[w];
+    }
+    return G;
+}
+
+/*
+ * Is the sum of the terms F always 1. This is the unate recursive paradigm:
+ * a cover with an empty term is a tautology, a cover where no variable
+ * appears both as x and !x (a unate cover) is not one unless it has an empty
+ * term, and otherwise F is a tautology if both cofactors by the variable
+ * appearing most in both polarities are.
+ */
+bool
+tautology (const Terms &F)
+{
+    std::vector<uint32_t> pos(F.words * 64, 0), neg(F.words * 64, 0);
+    std::vector<uint64_t> unit(2 * F.words, 0);
+    size_t best = 0;
+    uint32_t split = UINT32_MAX;
+
+    for (size_t i = 0; i < F.size(); i++) {
+        const uint64_t *t = F.term(i);
+        bool empty = true;
+        for (size_t w = 0; w < F.words; w++) {
+            for (uint64_t m = t[w]; m; m &= m - 1)
+                pos[w * 64 + __builtin_ctzll(m)]++;
+            for (uint64_t m = t[F.words + w]; m; m &= m - 1)
+                neg[w * 64 + __builtin_ctzll(m)]++;
+            empty = empty && !t[w] && !t[F.words + w];
+        }
+        if (empty)
+            return true;
+    }
+
+    for (uint32_t v = 0; v < pos.size(); v++) {
+        if (pos[v] && neg[v] && pos[v] + neg[v] > best) {
+            best = pos[v] + neg[v];
+            split = v;
+        }
+    }
+
+    if (split == UINT32_MAX)
+        return false;
+
+    unit[split / 64] = 1ULL << (split % 64);
+    if (!tautology(cofactor(F, unit.data())))
+        return false;
+    unit[split / 64] = 0;
+    unit[F.words + split / 64] = 1ULL << (split % 64);
+    return tautology(cofactor(F, unit.data()));
+}
+
+/*
+ * Does the sum of the terms F (less those in `skip') cover the term c. A
+ * single term holding c is checked first since it is the common case.
+ */
+bool
+covers (const Terms &F, const uint64_t *c, const std::vector<bool> *skip = NULL)
+{
+    for (size_t i = 0; i < F.size(); i++)
+        if (!(skip && (*skip)[i]) && inside(c, F.term(i), F.words))
+            return true;
+    return tautology(cofactor(F, c, skip));
+}
+
+/*
+ * EXPAND: make every term as large as it can go while staying inside F by
+ * dropping literals, and drop the terms the grown term now covers. The
+ * largest terms go first since they are the most likely to swallow others.
+ * Of the literals of a term the ones whose complement is most common are
+ * tried first: those are the ones other terms are waiting on to merge with.
+ */
+void
+expand (Terms &F)
+{
+    std::vector<uint32_t> pos(F.words * 64, 0), neg(F.words * 64, 0);
+    std::vector<bool> gone(F.size(), false);
+    std::vector<size_t> order;
+
+    F.sort(true);
+    for (size_t i = 0; i < F.size(); i++) {
+        const uint64_t *t = F.term(i);
+        for (size_t w = 0; w < F.words; w++) {
+            for (uint64_t m = t[w]; m; m &= m - 1)
+                pos[w * 64 + __builtin_ctzll(m)]++;
+            for (uint64_t m = t[F.words + w]; m; m &= m - 1)
+                neg[w * 64 + __builtin_ctzll(m)]++;
+        }
+    }
+
+    for (size_t i = 0; i < F.size(); i++) {
+        /* the literals as (how common the complement is, word index, bit) */
+        std::vector<std::pair<uint32_t, std::pair<size_t, uint64_t>>> literals;
+        std::vector<uint64_t> raised;
+        uint64_t *t = F.term(i);
+
+        order.push_back(i);
+        if (gone[i])
+            continue;
+
+        for (size_t w = 0; w < 2 * F.words; w++) {
+            for (uint64_t m = t[w]; m; m &= m - 1) {
+                uint32_t v = (w % F.words) * 64 + __builtin_ctzll(m);
+                uint32_t complement = w < F.words ? neg[v] : pos[v];
+                literals.push_back(std::make_pair(complement,
+                            std::make_pair(w, m & -m)));
+            }
+        }
+        std::stable_sort(literals.begin(), literals.end(),
+                         [](const std::pair<uint32_t,
+                                            std::pair<size_t, uint64_t>> &a,
+                            const std::pair<uint32_t,
+                                            std::pair<size_t, uint64_t>> &b) {
+            return a.first > b.first;
+        });
+
+        for (auto &l : literals) {
+            raised.assign(t, t + 2 * F.words);
+            raised[l.second.first] &= ~l.second.second;
+            if (covers(F, raised.data(), &gone))
+                std::copy(raised.begin(), raised.end(), t);
+        }
+
+        /* the terms inside the grown one */
+        for (size_t j = 0; j < F.size(); j++)
+            if (j != i && !gone[j] && inside(F.term(j), t, F.words))
+                gone[j] = true;
+    }
+
+    F.select(order, gone);
+}
+
+/*
+ * IRREDUNDANT: drop every term which the rest of F covers, smallest terms
+ * first.
+ */
+void
+irredundant (Terms &F)
+{
+    std::vector<bool> gone(F.size(), false);
+    std::vector<size_t> order;
+
+    F.sort(false);
+    for (size_t i = 0; i < F.size(); i++) {
+        gone[i] = true;
+        gone[i] = covers(F, F.term(i), &gone);
+        order.push_back(i);
+    }
+
+    F.select(order, gone);
+}
+
+/*
+ * REDUCE: shrink every term to just what it alone covers by adding the
+ * literals the rest of F makes unnecessary: x can be added to c when c!x is
+ * covered by the other terms. This moves the cover somewhere EXPAND can grow
+ * it differently. The rest of F is cofactored by the term once so each
+ * literal is only checked against the terms near it.
+ */
+void
+reduce_terms (Terms &F)
+{
+    std::vector<uint64_t> used(F.words, 0), unit(2 * F.words, 0);
+    std::vector<bool> gone(F.size(), false);
+    std::vector<size_t> order;
+
+    F.sort(true);
+    for (size_t i = 0; i < F.size(); i++)
+        for (size_t w = 0; w < F.words; w++)
+            used[w] |= F.term(i)[w] | F.term(i)[F.words + w];
+
+    for (size_t i = 0; i < F.size(); i++) {
+        uint64_t *t = F.term(i);
+
+        order.push_back(i);
+        gone[i] = true;
+        Terms rest = cofactor(F, t, &gone);
+        /* covered by the rest, so it shrinks away completely */
+        if (tautology(rest))
+            continue;
+        gone[i] = false;
+
+        for (size_t w = 0; w < F.words; w++) {
+            for (uint64_t m = used[w] & ~t[w] & ~t[F.words + w]; m;
+                 m &= m - 1) {
+                uint64_t bit = m & -m;
+                /* is t!x covered, then x can be added, and the other way */
+                for (size_t side = 0; side < 2; side++) {
+                    std::fill(unit.begin(), unit.end(), 0);
+                    unit[(side ? 0 : F.words) + w] = bit;
+                    Terms part = cofactor(rest, unit.data());
+                    if (!tautology(part))
+                        continue;
+                    t[(side ? F.words : 0) + w] |= bit;
+                    unit[(side ? 0 : F.words) + w] = 0;
+                    unit[(side ? F.words : 0) + w] = bit;
+                    rest = cofactor(rest, unit.data());
+                    break;
+                }
+            }
+        }
+    }
+
+    F.select(order, gone);
+}
+
+/* the cost of a cover: its terms first and then its literals */
+std::pair<size_t, size_t>
+cover_cost (const Terms &F)
+{
+    size_t literals = 0;
+    for (size_t i = 0; i < F.size(); i++)
+        literals += F.literals(i);
+    return std::make_pair(F.size(), literals);
+}
+
+/*
+ * Espresso: EXPAND and IRREDUNDANT to get a cover of primes none of which
+ * can be dropped, then REDUCE, EXPAND and IRREDUNDANT again for as long as
+ * that lowers the cost, up to `iterations' passes. The result is a near
+ * minimum cover without ever building the truth table or the complement of
+ * the function, so the number of variables doesn't matter.
+ *
+ * A product of sums f is handled as the sum of products of !f: swapping the
+ * literals of every clause gives the terms of !f. The cover must already be
+ * reduced, i.e. hold no cube with both x and !x.
+ */
+void
+espresso (Cover &C, unsigned iterations)
+{
+    bool dual = (C.type == AND);
+    size_t words;
+
+    C.canonical();
+    /* constants, which none of the below deal with */
+    if (C.cubes.empty() || C.cubes[0].size() == 0) {
+        if (!C.cubes.empty())
+            C.cubes.resize(1);
+        return;
+    }
+
+    words = C.cubes[0].words();
+    Terms F(words);
+    for (auto &c : C.cubes) {
+        const std::vector<uint64_t> &p = dual ? c.neg : c.pos;
+        const std::vector<uint64_t> &n = dual ? c.pos : c.neg;
+        F.bits.insert(F.bits.end(), p.begin(), p.end());
+        F.bits.insert(F.bits.end(), n.begin(), n.end());
+    }
+
+    expand(F);
+    irredundant(F);
+    Terms best = F;
+
+    for (unsigned i = 0; i < iterations; i++) {
+        reduce_terms(F);
+        expand(F);
+        irredundant(F);
+        if (cover_cost(F) >= cover_cost(best))
+            break;
+        best = F;
+    }
+
+    C.cubes.clear();
+    for (size_t i = 0; i < best.size(); i++) {
+        const uint64_t *t = best.term(i);
+        Cube c;
+        c.widen(words);
+        std::copy(t, t + words, (dual ? c.neg : c.pos).begin());
+        std::copy(t + words, t + 2 * words, (dual ? c.pos : c.neg).begin());
+        C.add(c);
+    }
+    C.canonical();
+}
+
+#endif
@@ -0,0 +1,263 @@
+#ifndef FLAT_HPP
+#define FLAT_HPP
+
+#include <memory>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <cstdint>
+#include <new>
+
+/* room for this many elements is made the first time one is inserted */
+static const uint32_t FLAT_FIRST_CAPACITY = 4;
+
+/*
+ * A set kept as a sorted array, in the same order and with the same insert
+ * semantics as std::set, so walking it or intersecting two of them runs over
+ * contiguous memory instead of chasing tree pointers. Inserting is a binary
+ * search and a shift, which is cheap for the handful of children most nodes
+ * have and free when things arrive in order.
+ *
+ * The elements can't live inside the set itself because a Node holds a set
+ * of Nodes, so the first insert makes room for a few at once instead. The
+ * allocator has to be stateless, like ArenaAllocator.
+ */
+template <typename T,
+          typename Compare = std::less<T>,
+          typename Alloc = std::allocator<T>>
+struct FlatSet {
+    typedef T value_type;
+    typedef const T *iterator;
+    typedef const T *const_iterator;
+    typedef std::reverse_iterator<const T *> reverse_iterator;
+    typedef std::reverse_iterator<const T *> const_reverse_iterator;
+
+    T *items;
+    uint32_t length;
+    uint32_t capacity;
+
+    FlatSet ()
+        : items(NULL)
+        , length(0)
+        , capacity(0)
+    { }
+
+    FlatSet (const FlatSet &other)
+        : items(NULL)
+        , length(0)
+        , capacity(0)
+    {
+        reserve(other.length);
+        std::uninitialized_copy(other.begin(), other.end(), items);
+        length = other.length;
+    }
+
+    FlatSet (FlatSet &&other) noexcept
+        : items(other.items)
+        , length(other.length)
+        , capacity(other.capacity)
+    {
+        other.items = NULL;
+        other.length = 0;
+        other.capacity = 0;
+    }
+
+    ~FlatSet ()
+    {
+        destroy();
+    }
+
+    FlatSet &
+    operator= (const FlatSet &other)
+    {
+        if (this != &other) {
+            FlatSet copy(other);
+            swap(copy);
+        }
+        return *this;
+    }
+
+    FlatSet &
+    operator= (FlatSet &&other) noexcept
+    {
+        if (this != &other) {
+            destroy();
+            swap(other);
+        }
+        return *this;
+    }
+
+    void
+    swap (FlatSet &other) noexcept
+    {
+        std::swap(items, other.items);
+        std::swap(length, other.length);
+        std::swap(capacity, other.capacity);
+    }
+
+    const T *
+    begin () const
+    {
+        return items;
+    }
+
+    const T *
+    end () const
+    {
+        return items + length;
+    }
+
+    reverse_iterator
+    rbegin () const
+    {
+        return reverse_iterator(end());
+    }
+
+    reverse_iterator
+    rend () const
+    {
+        return reverse_iterator(begin());
+    }
+
+    size_t
+    size () const
+    {
+        return length;
+    }
+
+    bool
+    empty () const
+    {
+        return length == 0;
+    }
+
+    void
+    clear ()
+    {
+        for (uint32_t i = 0; i < length; i++)
+            items[i].~T();
+        length = 0;
+    }
+
+    void
+    reserve (size_t count)
+    {
+        T *bigger;
+
+        if (count <= capacity)
+            return;
+        count = std::max(count, (size_t) FLAT_FIRST_CAPACITY);
+        bigger = Alloc().allocate(count);
+        for (uint32_t i = 0; i < length; i++) {
+            new (bigger + i) T(std::move(items[i]));
+            items[i].~T();
+        }
+        if (items)
+            Alloc().deallocate(items, capacity);
+        items = bigger;
+        capacity = count;
+    }
+
+    const T *
+    find (const T &value) const
+    {
+        const T *it = std::lower_bound(begin(), end(), value, Compare());
+        if (it != end() && !Compare()(value, *it))
+            return it;
+        return end();
+    }
+
+    size_t
+    count (const T &value) const
+    {
+        return find(value) != end();
+    }
+
+    std::pair<iterator, bool>
+    insert (const T &value)
+    {
+        return place(value);
+    }
+
+    std::pair<iterator, bool>
+    insert (T &&value)
+    {
+        return place(std::move(value));
+    }
+
+    /* for std::inserter, the hint isn't needed to find the place */
+    iterator
+    insert (const_iterator, const T &value)
+    {
+        return place(value).first;
+    }
+
+    bool
+    operator== (const FlatSet &other) const
+    {
+        return length == other.length &&
+               std::equal(begin(), end(), other.begin());
+    }
+
+    bool
+    operator!= (const FlatSet &other) const
+    {
+        return !(*this == other);
+    }
+
+private:
+    template <typename V>
+    std::pair<iterator, bool>
+    place (V &&value)
+    {
+        size_t pos = length;
+
+        /* appending in order is the usual case and needs no search */
+        if (length > 0 && !Compare()(items[length - 1], value)) {
+            pos = std::lower_bound(begin(), end(), value, Compare()) - items;
+            if (!Compare()(value, items[pos]))
+                return std::make_pair(items + pos, false);
+        }
+
+        /*
+         * The value may be an element of this set, or part of one, so it is
+         * copied out before the elements move to bigger storage.
+         */
+        if (length == capacity) {
+            T copy(std::forward<V>(value));
+            reserve(std::max(capacity * 2, FLAT_FIRST_CAPACITY));
+            return put(pos, std::move(copy));
+        }
+        return put(pos, std::forward<V>(value));
+    }
+
+    /* there is room for one more and `pos' is where the value goes */
+    template <typename V>
+    std::pair<iterator, bool>
+    put (size_t pos, V &&value)
+    {
+        if (pos == length) {
+            new (items + length) T(std::forward<V>(value));
+        } else {
+            new (items + length) T(std::move(items[length - 1]));
+            std::move_backward(items + pos, items + length - 1,
+                               items + length);
+            items[pos] = std::forward<V>(value);
+        }
+        length++;
+        return std::make_pair(items + pos, true);
+    }
+
+    void
+    destroy ()
+    {
+        clear();
+        if (items)
+            Alloc().deallocate(items, capacity);
+        items = NULL;
+        capacity = 0;
+    }
+};
+
+#endif
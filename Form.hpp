@@ -0,0 +1,941 @@
+#ifndef FORM_HPP
+#define FORM_HPP
+
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <memory>
+#include "Node.hpp"
+#include "Store.hpp"
+#include "Cube.hpp"
+#include "Espresso.hpp"
+#include "Pool.hpp"
+#include "Cache.hpp"
+
+/*
+ * The workers one conversion may share its subtrees and its distributing out
+ * over. It is per thread so batch mode, which already gives each worker its
+ * own expressions, leaves it at 1 on every worker.
+ */
+static thread_local size_t CONVERSION_WORKERS = 1;
+/* a product of covers with fewer cubes than this is made on one thread */
+static size_t PARALLEL_PRODUCT = 1 << 14;
+/* a subtree of fewer nodes than this is converted by whoever needs it */
+static size_t PARALLEL_SUBTREE = 16;
+
+bool
+children_has_type (const Store &S,
+                   const std::vector<NodeId> &children,
+                   const NodeType type)
+{
+    for (auto child : children)
+        if (S.type(child) == type)
+            return true;
+    return false;
+}
+
+void
+remove_children_of_type (const Store &S,
+                         std::vector<NodeId> &children,
+                         const NodeType type)
+{
+    for (auto it = children.begin(); it != children.end();) {
+        if (S.type(*it) == type)
+            it = children.erase(it);
+        else
+            it++;
+    }
+}
+
+void
+reduce_to_type (std::vector<NodeId> &children, NodeType &parent_type,
+                const NodeType type)
+{
+    children.clear();
+    parent_type = type;
+}
+
+/* a => !a; !a => a */
+NodeId
+negate_var (Store &S, NodeId N)
+{
+    return S.make_var(S.var(N), !S.negated(N));
+}
+
+/*
+ * This is Node::add_reduction for a list of children which will become a node
+ * of type `parent_type' in the store.
+ */
+void
+add_reduction (const Store &S,
+               const NodeType parent_type,
+               std::vector<NodeId> &children,
+               NodeId child)
+{
+    if (!S.is_operator(child) || S.type(child) == NOT) {
+        children.push_back(child);
+    } else if (S.type(child) == parent_type) {
+        for (size_t i = 0; i < S.size(child); i++)
+            add_reduction(S, parent_type, children, S.child(child, i));
+    } else if (S.size(child) == 1) {
+        add_reduction(S, parent_type, children, S.child(child, 0));
+    } else {
+        children.push_back(child);
+    }
+}
+
+NodeId
+reduce (Store &S, NodeId parent)
+{
+    std::vector<NodeId> reduced_children, children;
+    NodeType type = S.type(parent);
+
+    if (S.size(parent) == 0)
+        return parent;
+
+    for (size_t i = 0; i < S.size(parent); i++)
+        reduced_children.push_back(reduce(S, S.child(parent, i)));
+    for (auto child : reduced_children)
+        add_reduction(S, type, children, child);
+    std::sort(children.begin(), children.end());
+    children.erase(std::unique(children.begin(), children.end()),
+                   children.end());
+
+    /* a0bc => 0 */
+    if (type == AND && children_has_type(S, children, FALSE)) {
+        reduce_to_type(children, type, FALSE);
+        goto exit;
+    }
+
+    /* a1bc => abc */
+    if (type == AND && children_has_type(S, children, TRUE))
+        remove_children_of_type(S, children, TRUE);
+
+    /* a+0+b+c => a+b+c */
+    if (type == OR && children_has_type(S, children, FALSE))
+        remove_children_of_type(S, children, FALSE);
+
+    /* a+1+b+c => 1 */
+    if (type == OR && children_has_type(S, children, TRUE)) {
+        reduce_to_type(children, type, TRUE);
+        goto exit;
+    }
+
+    /*
+     * For some var in values, if the negated var is contained in values, then
+     * we reduce. If we are 'ORing' then node becomes '1', if 'ANDing' then
+     * node becomes '1'.
+     * a+!a+b+c => 1
+     * a!abc => 0
+     */
+    for (auto child : children) {
+        if (S.type(child) != VAR)
+            continue;
+        if (!std::binary_search(children.begin(), children.end(),
+                                negate_var(S, child)))
+            continue;
+        if (type == OR)
+            reduce_to_type(children, type, TRUE);
+        else
+            reduce_to_type(children, type, FALSE);
+        break;
+    }
+
+    /* an empty product is true and an empty sum is false */
+    if (children.empty() && type == AND)
+        type = TRUE;
+    if (children.empty() && type == OR)
+        type = FALSE;
+
+exit:
+    return S.make(type, children);
+}
+
+/*
+ * The cubes of a cover made one at a time, kept so that none of them contains
+ * another, with an index to find the cubes one cube could contain or be
+ * contained in without looking at all of them.
+ *
+ * Every literal has the list of cubes it occurs in. A cube which C is in has
+ * every literal of C, so only the list of C's rarest literal has to be read.
+ * A cube which is in C has one of its literals in C, so each cube is also
+ * watched under a single literal and only the watches of C's literals are
+ * read. Either way a candidate is passed over unless its signature fits,
+ * before its words are compared.
+ *
+ * Dropped cubes are only marked dead and are cleared out of the lists once
+ * they outnumber the live ones. The live cubes keep the order they came in.
+ */
+struct Minimal {
+    std::vector<Cube> cubes;
+    std::vector<uint64_t> signatures;
+    std::vector<bool> live;
+    std::vector<std::vector<uint32_t>> occurs;
+    std::vector<std::vector<uint32_t>> watches;
+    /* the cubes of no literals, which are in every cube */
+    std::vector<uint32_t> empty;
+    size_t alive;
+    /* scratch for the literals of a cube */
+    std::vector<uint32_t> lits;
+
+    Minimal ()
+        : alive(0)
+    { }
+
+    size_t
+    size () const
+    {
+        return alive;
+    }
+
+    /* does C hold every literal of one of the cubes */
+    bool
+    subsumes (const Cube &C)
+    {
+        uint64_t sig = C.signature();
+
+        for (auto i : empty)
+            if (live[i])
+                return true;
+        C.literals(lits);
+        for (auto l : lits) {
+            if (l >= watches.size())
+                break;
+            for (auto i : watches[l]) {
+                if (live[i] && (signatures[i] & ~sig) == 0 &&
+                    C.contains(cubes[i]))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    /*
+     * Add C, which no cube is in. Unless the caller knows better, e.g. the
+     * cubes come smallest first, every cube which C is in is dropped.
+     */
+    void
+    add (const Cube &C, bool absorb = true)
+    {
+        uint64_t sig = C.signature();
+        uint32_t index = cubes.size();
+        uint32_t rarest = UINT32_MAX;
+
+        C.literals(lits);
+        for (auto l : lits) {
+            if (l >= occurs.size()) {
+                occurs.resize(l + 1);
+                watches.resize(l + 1);
+            }
+            if (rarest == UINT32_MAX ||
+                occurs[l].size() < occurs[rarest].size())
+                rarest = l;
+        }
+
+        if (absorb && lits.empty()) {
+            for (size_t i = 0; i < cubes.size(); i++)
+                drop(i);
+        } else if (absorb) {
+            for (auto i : occurs[rarest]) {
+                if (live[i] && (sig & ~signatures[i]) == 0 &&
+                    cubes[i].contains(C))
+                    drop(i);
+            }
+        }
+
+        cubes.push_back(C);
+        signatures.push_back(sig);
+        live.push_back(true);
+        alive++;
+        for (auto l : lits)
+            occurs[l].push_back(index);
+        if (lits.empty())
+            empty.push_back(index);
+        else
+            watches[rarest].push_back(index);
+
+        if (cubes.size() > 2 * alive + 64)
+            compact();
+    }
+
+    /* move the live cubes out, in the order they were added */
+    void
+    take (std::vector<Cube> &out)
+    {
+        out.clear();
+        for (size_t i = 0; i < cubes.size(); i++)
+            if (live[i])
+                out.push_back(std::move(cubes[i]));
+        *this = Minimal();
+    }
+
+private:
+    void
+    drop (size_t i)
+    {
+        if (live[i]) {
+            live[i] = false;
+            alive--;
+        }
+    }
+
+    /* forget the dead cubes and index the live ones again */
+    void
+    compact ()
+    {
+        std::vector<Cube> kept;
+
+        take(kept);
+        for (auto &C : kept)
+            add(C, false);
+    }
+};
+
+/*
+ * We join a cube of the factor at index `i' onto Y[i] giving Y[i + 1], for
+ * each of its cubes. If there is no next factor the cube is finished and goes
+ * into Z. Only one cube is ever being built so nothing is kept but Z.
+ *
+ * A cube with both x and !x is 1 as a clause and 0 as a term, and a cube with
+ * all of some cube of Z is absorbed by it, so either way it is dropped as soon
+ * as it is made along with every cube it would have been extended to.
+ */
+void distribute_cube (const std::vector<Cover> &factors,
+                      std::vector<Cube> &Y,
+                      Minimal &Z,
+                      size_t i,
+                      const Cube &cube);
+
+void
+distribute_node (const std::vector<Cover> &factors,
+                 std::vector<Cube> &Y,
+                 Minimal &Z,
+                 size_t i)
+{
+    for (auto &cube : factors[i].cubes)
+        distribute_cube(factors, Y, Z, i, cube);
+}
+
+void
+distribute_cube (const std::vector<Cover> &factors,
+                 std::vector<Cube> &Y,
+                 Minimal &Z,
+                 size_t i,
+                 const Cube &cube)
+{
+    Cube &next = Y[i + 1];
+    next = Y[i];
+    next.join(cube);
+    if (next.contradicts() || Z.subsumes(next))
+        return;
+    if (i + 1 == factors.size())
+        Z.add(next);
+    else
+        distribute_node(factors, Y, Z, i + 1);
+}
+
+/* move every cube of B which isn't absorbed into A */
+void
+merge_minimal (Minimal &A, Minimal &B)
+{
+    std::vector<Cube> cubes;
+
+    B.take(cubes);
+    for (auto &cube : cubes)
+        if (!A.subsumes(cube))
+            A.add(cube);
+}
+
+/*
+ * Multiply out the covers into Z. A large product is split up by the cubes of
+ * its largest factor, which go first, over the workers of `pool'. Each worker
+ * keeps a Z of its own and those are merged in pairs, the pairs of one round
+ * at the same time. The cubes no other cube is in are the same set however
+ * the work was split, and minimum_sets puts them in order afterwards, so the
+ * result is the same for any number of workers.
+ */
+void
+distribute (std::vector<Cover> &factors, Minimal &Z, Pool *pool)
+{
+    size_t product = 1, largest = 0;
+
+    for (size_t i = 0; i < factors.size(); i++) {
+        product = std::min(product * std::max(factors[i].cubes.size(),
+                                              (size_t) 1),
+                           PARALLEL_PRODUCT);
+        if (factors[i].cubes.size() > factors[largest].cubes.size())
+            largest = i;
+    }
+
+    if (!pool || product < PARALLEL_PRODUCT ||
+        factors[largest].cubes.size() < 2) {
+        std::vector<Cube> Y(factors.size() + 1);
+        distribute_node(factors, Y, Z, 0);
+        return;
+    }
+
+    std::swap(factors[0], factors[largest]);
+    std::vector<Minimal> parts(pool->workers());
+    std::vector<std::vector<Cube>> Ys(pool->workers(),
+                                      std::vector<Cube>(factors.size() + 1));
+
+    pool->run(factors[0].cubes.size(), [&] (size_t j, size_t w) {
+        distribute_cube(factors, Ys[w], parts[w], 0, factors[0].cubes[j]);
+    });
+
+    for (size_t step = 1; step < parts.size(); step *= 2) {
+        size_t pairs = (parts.size() - step + 2 * step - 1) / (2 * step);
+        pool->run(pairs, [&] (size_t j, size_t) {
+            merge_minimal(parts[2 * step * j], parts[2 * step * j + step]);
+        });
+    }
+    Z = std::move(parts[0]);
+}
+
+/*
+ * The reduce rules for a cover. A cube which holds both x and !x is 0 as a
+ * term and 1 as a clause so either way it drops out of the cover. A cube of
+ * just x alongside a cube of just !x makes the whole cover trivial, which is
+ * the cover of a single empty cube.
+ * a+!a+b+c => 1
+ * a!abc => 0
+ */
+void
+reduce (Cover &C)
+{
+    Cube units;
+
+    C.cubes.erase(std::remove_if(C.cubes.begin(), C.cubes.end(),
+                                 [](const Cube &c) { return c.contradicts(); }),
+                  C.cubes.end());
+
+    for (auto &cube : C.cubes)
+        if (cube.size() == 1)
+            units.join(cube);
+
+    if (units.contradicts()) {
+        C.cubes.clear();
+        C.add(Cube());
+    }
+}
+
+/*
+ * For any cube of the cover, if that cube contains another cube then it is
+ * redundant and should be filtered. We use this filtering process to find the
+ * minimum sets. Cubes are visited smallest first so that only the cubes
+ * already kept can be the ones contained, and none of those can be dropped
+ * by a later one.
+ */
+void
+minimum_sets (Cover &C)
+{
+    Minimal kept;
+
+    C.canonical();
+    std::stable_sort(C.cubes.begin(), C.cubes.end(),
+                     [](const Cube &a, const Cube &b) {
+                         return a.size() < b.size();
+                     });
+
+    for (auto &cube : C.cubes)
+        if (!kept.subsumes(cube))
+            kept.add(cube, false);
+
+    kept.take(C.cubes);
+}
+
+/*
+ * Push every negation down to the variables so that the conversions only see
+ * AND, OR and literals.
+ * !(a+b) => !a!b
+ * !(ab) => !a+!b
+ * !(!(a)) => a
+ * Shared subexpressions are only rewritten once for each polarity.
+ */
+NodeId
+push_negations (Store &S,
+                NodeId N,
+                bool negate,
+                std::unordered_map<uint64_t, NodeId> &memo)
+{
+    uint64_t key = ((uint64_t) N << 1) | negate;
+    std::vector<NodeId> children;
+    NodeId result;
+    NodeType type = S.type(N);
+
+    auto found = memo.find(key);
+    if (found != memo.end())
+        return found->second;
+
+    switch (type) {
+        case VAR:
+            result = negate ? negate_var(S, N) : N;
+            break;
+        case TRUE:
+        case FALSE:
+            result = negate ? S.make(type == TRUE ? FALSE : TRUE) : N;
+            break;
+        case NOT:
+            result = push_negations(S, S.child(N, 0), !negate, memo);
+            break;
+        default:
+            for (size_t i = 0; i < S.size(N); i++)
+                children.push_back(push_negations(S, S.child(N, i), negate,
+                                                  memo));
+            if (negate)
+                type = (type == AND) ? OR : AND;
+            result = S.make(type, children);
+            break;
+    }
+
+    memo[key] = result;
+    return result;
+}
+
+NodeId
+push_negations (Store &S, NodeId N)
+{
+    std::unordered_map<uint64_t, NodeId> memo;
+    return push_negations(S, N, false, memo);
+}
+
+NodeId to_cnf (Store &S, NodeId tree);
+NodeId to_dnf (Store &S, NodeId tree);
+
+/* subtrees of fewer nodes than this are quicker to convert than to look up */
+static const size_t CACHE_MIN_NODES = 8;
+
+/*
+ * What one conversion knows: the subtrees converted already, the number of
+ * nodes and the cache key of each node up to the one being converted, and
+ * the workers it shares its work over, if it has more than one.
+ */
+struct Conversion {
+    NodeType expr_type;
+    NodeType clause_type;
+    std::unordered_map<NodeId, NodeId> converted;
+    std::vector<size_t> weight;
+    std::vector<ConversionCache::Key> keys;
+    std::unique_ptr<Pool> pool;
+
+    Conversion (const NodeType expr_type, const NodeType clause_type)
+        : expr_type(expr_type)
+        , clause_type(clause_type)
+    { }
+};
+
+/* splitmix64's finalizer */
+uint64_t
+key_mix (uint64_t h)
+{
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+/*
+ * The number of nodes in the tree under each node up to `tree', counting a
+ * shared subexpression each time it is used. Children are always made before
+ * their parents so have smaller ids, and one pass in id order does it.
+ */
+void
+subtree_weights (const Store &S, NodeId tree, std::vector<size_t> &weight)
+{
+    weight.assign(tree + 1, 0);
+    for (NodeId id = 0; id <= tree; id++) {
+        weight[id] = 1;
+        for (size_t i = 0; i < S.size(id); i++)
+            weight[id] = std::min(weight[id] + weight[S.child(id, i)],
+                                  (size_t) UINT32_MAX);
+    }
+}
+
+/*
+ * The cache key of each node up to `tree', in two independent halves. Like
+ * Node::hash the children are summed in, so the key is the same whatever
+ * ids the store gave them, and each sum is mixed again before it goes up.
+ * The size and variables the cache checks an entry against go up with it.
+ */
+void
+subtree_keys (const Store &S,
+              NodeId tree,
+              NodeType form,
+              std::vector<ConversionCache::Key> &keys)
+{
+    keys.resize(tree + 1);
+    for (NodeId id = 0; id <= tree; id++) {
+        uint64_t leaf = ((uint64_t) S.type(id) << 40) |
+                        ((uint64_t) S.var(id) << 1) | S.negated(id);
+        uint64_t first = key_mix(leaf);
+        uint64_t second = key_mix(leaf ^ 0x9e3779b97f4a7c15ULL);
+
+        uint64_t nodes = 1;
+        uint64_t support = 0;
+
+        if (S.type(id) == VAR)
+            support = 1ULL << (S.var(id) % 64);
+        for (size_t i = 0; i < S.size(id); i++) {
+            const ConversionCache::Key &child = keys[S.child(id, i)];
+            first += key_mix(child.first);
+            second += key_mix(child.second ^ 0xc2b2ae3d27d4eb4fULL);
+            nodes = std::min(nodes + child.nodes, (uint64_t) UINT32_MAX);
+            support |= child.support;
+        }
+        keys[id].first = key_mix(first);
+        keys[id].second = key_mix(second + 0x165667b19e3779f9ULL);
+        keys[id].form = form;
+        keys[id].nodes = nodes;
+        keys[id].support = support;
+    }
+}
+
+/*
+ * This converts the entire expression tree to CNF form from the leaves up to
+ * the root node.
+ *
+ * Once its children are converted a node which isn't already a cover is a sum
+ * of CNFs (or a product of DNFs), i.e. a list of covers which have to be
+ * multiplied out. Each cube of the result is one cube from every cover joined
+ * together, made by distribute_node.
+ *
+ * This is effectively an algorithm that creates, through the use of recursive
+ * function calls, an N-deep 'for loop' for the children of the given tree.
+ * Imagine the tree for 'ab+cd+ef', there would be 3 for loops. The string would
+ * be a+c+e, then a+c+f, then a+d+e, etc. just like a for-loop works.
+ *
+ * Subtrees are never copied: every step makes (or finds) nodes in the store
+ * and passes ids around, and the distributed cubes are never put in the store
+ * at all. A subtree done already in this conversion is only looked up, and
+ * one big enough is looked for in the CONVERSION_CACHE before it is done and
+ * put there after.
+ */
+NodeId
+conversion_dfs (Store &S, NodeId tree, Conversion &state)
+{
+    const NodeType expr_type = state.expr_type;
+    std::vector<NodeId> new_children, children;
+    NodeType type = S.type(tree);
+    NodeId original = tree, result;
+    Cover C(expr_type);
+    bool cached;
+
+    if (S.size(tree) == 0)
+        return tree;
+
+    auto found = state.converted.find(tree);
+    if (found != state.converted.end())
+        return found->second;
+
+    cached = CONVERSION_CACHE && state.weight[tree] >= CACHE_MIN_NODES;
+    if (cached && CONVERSION_CACHE->find(state.keys[tree], C)) {
+        result = from_cover(S, C);
+        state.converted[original] = result;
+        return result;
+    }
+
+    for (size_t i = 0; i < S.size(tree); i++)
+        new_children.push_back(conversion_dfs(S, S.child(tree, i), state));
+    for (auto child : new_children)
+        add_reduction(S, type, children, child);
+    tree = S.make(type, children);
+
+    if (!to_cover(S, tree, expr_type, C)) {
+        std::vector<Cover> factors(children.size());
+        Minimal Z;
+
+        for (size_t i = 0; i < children.size(); i++) {
+            if (!to_cover(S, children[i], expr_type, factors[i])) {
+                result = reduce(S, tree);
+                state.converted[original] = result;
+                return result;
+            }
+        }
+        distribute(factors, Z, state.pool.get());
+        Z.take(C.cubes);
+    }
+
+    reduce(C);
+    minimum_sets(C);
+    if (C.cubes.size() >= ESPRESSO_MIN_CUBES)
+        espresso(C, ESPRESSO_ITERATIONS);
+    if (cached)
+        CONVERSION_CACHE->insert(state.keys[original], C);
+    result = from_cover(S, C);
+    state.converted[original] = result;
+    return result;
+}
+
+NodeId convert (Store &S,
+                NodeId tree,
+                const NodeType expr_type,
+                const NodeType clause_type);
+
+/*
+ * The subtrees to convert as tasks: the largest ones under `limit' nodes,
+ * leaving out the ones too small to be worth a task.
+ */
+void
+subtree_tasks (const Store &S,
+               NodeId N,
+               const std::vector<size_t> &weight,
+               size_t limit,
+               std::vector<bool> &seen,
+               std::vector<NodeId> &tasks)
+{
+    if (seen[N] || weight[N] < PARALLEL_SUBTREE)
+        return;
+    seen[N] = true;
+    if (weight[N] <= limit) {
+        tasks.push_back(N);
+        return;
+    }
+    for (size_t i = 0; i < S.size(N); i++)
+        subtree_tasks(S, S.child(N, i), weight, limit, seen, tasks);
+}
+
+/*
+ * Convert the large independent subtrees of `tree' at the same time, filling
+ * in what is converted for conversion_dfs to pick up. The tree is cut into
+ * pieces of a few times fewer nodes than there are workers to go round, and
+ * what is above the pieces is left to conversion_dfs.
+ *
+ * The store can't be written by two threads, so each task copies its subtree
+ * into a store of its own and the result is copied back, in the order of the
+ * tasks. A cover comes out in the same canonical order whatever the ids of
+ * its cubes were, so the result is the same as converting on one thread.
+ */
+void
+convert_subtrees (Store &S, NodeId tree, Conversion &state)
+{
+    std::vector<bool> seen(tree + 1, false);
+    std::vector<NodeId> tasks;
+
+    subtree_tasks(S, tree, state.weight,
+                  std::max(PARALLEL_SUBTREE,
+                           state.weight[tree] / (4 * CONVERSION_WORKERS)),
+                  seen, tasks);
+    if (tasks.size() < 2)
+        return;
+
+    std::vector<Store> stores(tasks.size());
+    std::vector<NodeId> results(tasks.size());
+
+    state.pool->run(tasks.size(), [&] (size_t j, size_t) {
+        std::unordered_map<NodeId, NodeId> copied;
+        size_t workers = CONVERSION_WORKERS;
+
+        /* the workers are all busy with tasks already */
+        CONVERSION_WORKERS = 1;
+        results[j] = convert(stores[j], stores[j].copy(S, tasks[j], copied),
+                             state.expr_type, state.clause_type);
+        CONVERSION_WORKERS = workers;
+    });
+
+    for (size_t j = 0; j < tasks.size(); j++) {
+        std::unordered_map<NodeId, NodeId> copied;
+        state.converted[tasks[j]] = S.copy(stores[j], results[j], copied);
+    }
+}
+
+NodeId
+convert (Store &S,
+         NodeId tree,
+         const NodeType expr_type,
+         const NodeType clause_type)
+{
+    Conversion state(expr_type, clause_type);
+
+    subtree_weights(S, tree, state.weight);
+    if (CONVERSION_CACHE)
+        subtree_keys(S, tree, expr_type, state.keys);
+    if (CONVERSION_WORKERS > 1) {
+        state.pool.reset(new Pool(CONVERSION_WORKERS));
+        convert_subtrees(S, tree, state);
+    }
+    return conversion_dfs(S, tree, state);
+}
+
+NodeId
+to_cnf (Store &S, NodeId tree)
+{
+    return convert(S, push_negations(S, tree), AND, OR);
+}
+
+NodeId
+to_dnf (Store &S, NodeId tree)
+{
+    return convert(S, push_negations(S, tree), OR, AND);
+}
+
+/* the polarities an expression can appear in within the whole */
+static const uint8_t POSITIVE = 1;
+static const uint8_t NEGATIVE = 2;
+
+/*
+ * Mark every node with the polarities it is used in: a NOT flips the polarity
+ * of its child. Each node is walked once for each polarity at most.
+ */
+void
+mark_polarity (const Store &S,
+               NodeId N,
+               uint8_t polarity,
+               std::vector<uint8_t> &marks)
+{
+    if ((marks[N] & polarity) == polarity)
+        return;
+    marks[N] |= polarity;
+
+    if (S.type(N) == NOT) {
+        uint8_t flipped = ((polarity & POSITIVE) ? NEGATIVE : 0) |
+                          ((polarity & NEGATIVE) ? POSITIVE : 0);
+        mark_polarity(S, S.child(N, 0), flipped, marks);
+        return;
+    }
+    for (size_t i = 0; i < S.size(N); i++)
+        mark_polarity(S, S.child(N, i), polarity, marks);
+}
+
+/*
+ * The state of one encoding: the literal of each node (var << 1 | negated),
+ * the next free variable and the variable standing for 1 if any constant
+ * needed one.
+ */
+struct Encoding {
+    std::vector<uint8_t> polarity;
+    std::vector<uint32_t> literal;
+    uint32_t next;
+    uint32_t truth;
+    Cover clauses;
+
+    Encoding (size_t nodes, uint32_t first_aux)
+        : polarity(nodes, 0)
+        , literal(nodes, UINT32_MAX)
+        , next(first_aux)
+        , truth(UINT32_MAX)
+        , clauses(AND)
+    { }
+
+    void
+    add_clause (const std::vector<uint32_t> &literals)
+    {
+        Cube C;
+        for (auto l : literals)
+            C.add(l >> 1, l & 1);
+        clauses.add(C);
+    }
+};
+
+/*
+ * The literal for N, adding the clauses which define it. Every AND and OR
+ * gets a new variable g but only the half of g <=> gate which its polarity
+ * needs (Plaisted-Greenbaum): where N is only used positively g => gate is
+ * enough since nothing can gain from g being false when the gate is true,
+ * and the other way around where it is only used negatively.
+ */
+uint32_t
+encode (const Store &S, NodeId N, Encoding &E)
+{
+    std::vector<uint32_t> children, clause;
+    uint32_t g;
+
+    if (E.literal[N] != UINT32_MAX)
+        return E.literal[N];
+
+    switch (S.type(N)) {
+        case VAR:
+            E.literal[N] = (S.var(N) << 1) | S.negated(N);
+            return E.literal[N];
+        case TRUE:
+        case FALSE:
+            if (E.truth == UINT32_MAX) {
+                E.truth = E.next++;
+                E.add_clause(std::vector<uint32_t>(1, E.truth << 1));
+            }
+            E.literal[N] = (E.truth << 1) | (S.type(N) == FALSE);
+            return E.literal[N];
+        case NOT:
+            E.literal[N] = encode(S, S.child(N, 0), E) ^ 1;
+            return E.literal[N];
+        default:
+            break;
+    }
+
+    for (size_t i = 0; i < S.size(N); i++)
+        children.push_back(encode(S, S.child(N, i), E));
+    g = E.next++ << 1;
+
+    /* the product or sum of the children implies g, or g implies it */
+    bool forward = (E.polarity[N] & POSITIVE);
+    bool backward = (E.polarity[N] & NEGATIVE);
+    if (S.type(N) == OR)
+        std::swap(forward, backward);
+
+    /* AND: g => each child, or all the children => g */
+    if (forward) {
+        for (auto c : children) {
+            clause.assign(1, S.type(N) == AND ? g ^ 1 : g);
+            clause.push_back(S.type(N) == AND ? c : c ^ 1);
+            E.add_clause(clause);
+        }
+    }
+    if (backward) {
+        clause.assign(1, S.type(N) == AND ? g : g ^ 1);
+        for (auto c : children)
+            clause.push_back(S.type(N) == AND ? c ^ 1 : c);
+        E.add_clause(clause);
+    }
+
+    E.literal[N] = g;
+    return g;
+}
+
+/*
+ * An equisatisfiable CNF of N in clauses linear in its size, rather than the
+ * exact CNF which can be exponential. The new variables start at `first_aux'
+ * and the models of the CNF are the models of N extended to them.
+ */
+Cover
+tseitin (const Store &S, NodeId N, uint32_t first_aux)
+{
+    Encoding E(S.count(), first_aux);
+
+    mark_polarity(S, N, POSITIVE, E.polarity);
+    E.add_clause(std::vector<uint32_t>(1, encode(S, N, E)));
+    return E.clauses;
+}
+
+/*
+ * The new variables go after every variable of N and after every name in the
+ * symbol table, so they print as _1, _2, ...
+ */
+uint32_t
+first_aux_var (const Store &S, NodeId N)
+{
+    std::vector<bool> seen(S.count(), false);
+    std::vector<NodeId> stack(1, N);
+    uint32_t first = SYMBOLS.size();
+
+    while (!stack.empty()) {
+        NodeId id = stack.back();
+        stack.pop_back();
+        if (seen[id])
+            continue;
+        seen[id] = true;
+        if (S.type(id) == VAR)
+            first = std::max(first, S.var(id) + 1);
+        for (size_t i = 0; i < S.size(id); i++)
+            stack.push_back(S.child(id, i));
+    }
+    return first;
+}
+
+NodeId
+to_tseitin (Store &S, NodeId tree)
+{
+    return from_cover(S, tseitin(S, tree, first_aux_var(S, tree)));
+}
+
+#endif
@@ -0,0 +1,614 @@
+#ifndef MINIMIZE_HPP
+#define MINIMIZE_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "Node.hpp"
+#include "Store.hpp"
+#include "Cube.hpp"
+#include "Truth.hpp"
+#include "Form.hpp"
+#include "Espresso.hpp"
+
+/*
+ * Exact minimization keeps a byte for every cube over the variables, which is
+ * 3^n bytes, so it is limited to this many variables (43MB at 16).
+ */
+static const size_t MAX_EXACT_VARS = 16;
+
+/*
+ * A cube over the variables of a truth table: the variables set in `dashes'
+ * are free and the rest have the value of their bit in `value'.
+ */
+struct Implicant {
+    uint32_t value;
+    uint32_t dashes;
+
+    /* the number of literals */
+    unsigned
+    size (size_t vars) const
+    {
+        return vars - __builtin_popcount(dashes);
+    }
+};
+
+/* flags of a cube in the table of every cube */
+static const uint8_t IMPLICANT = 1;
+static const uint8_t NOT_PRIME = 2;
+
+/*
+ * Quine-McCluskey over the table of every cube. A cube is indexed by its
+ * variables as base 3 digits: 0 for !x, 1 for x and 2 for a dash. Merging
+ * two implicants which differ in variable j is then an AND of the groups of
+ * cubes with digit 0 and 1 at j into the group with a 2 at j, and merging the
+ * variables one at a time reaches every implicant. Each group is a
+ * contiguous run of 3^j cubes so this is a handful of long linear passes
+ * rather than a pairwise compare. An implicant is prime when none of the
+ * merges it could take part in produced an implicant.
+ */
+std::vector<Implicant>
+prime_implicants (const TruthTable &T)
+{
+    std::vector<Implicant> primes;
+    std::vector<uint8_t> cubes;
+    std::vector<size_t> power(T.vars.size() + 1, 1);
+    size_t n = T.vars.size();
+
+    assert(n <= MAX_EXACT_VARS);
+
+    for (size_t j = 0; j < n; j++)
+        power[j + 1] = power[j] * 3;
+    cubes.assign(power[n], 0);
+
+    /* the minterms, i.e. the cubes without a dash */
+    for (uint64_t m = 0; m < ((uint64_t) 1 << n); m++) {
+        size_t index = 0;
+        if (!T.value(m))
+            continue;
+        for (size_t j = 0; j < n; j++)
+            if ((m >> j) & 1)
+                index += power[j];
+        cubes[index] = IMPLICANT;
+    }
+
+    for (size_t j = 0; j < n; j++) {
+        for (size_t base = 0; base < power[n]; base += power[j + 1]) {
+            uint8_t *zero = &cubes[base];
+            uint8_t *one = zero + power[j];
+            uint8_t *dash = one + power[j];
+            for (size_t i = 0; i < power[j]; i++)
+                dash[i] = zero[i] & one[i];
+        }
+    }
+
+    for (size_t j = 0; j < n; j++) {
+        for (size_t base = 0; base < power[n]; base += power[j + 1]) {
+            uint8_t *zero = &cubes[base];
+            uint8_t *one = zero + power[j];
+            uint8_t *dash = one + power[j];
+            for (size_t i = 0; i < power[j]; i++) {
+                if (dash[i] & IMPLICANT) {
+                    zero[i] |= NOT_PRIME;
+                    one[i] |= NOT_PRIME;
+                }
+            }
+        }
+    }
+
+    for (size_t index = 0; index < power[n]; index++) {
+        Implicant I{ 0, 0 };
+        if (cubes[index] != IMPLICANT)
+            continue;
+        for (size_t j = 0, rest = index; j < n; j++, rest /= 3) {
+            if (rest % 3 == 2)
+                I.dashes |= 1u << j;
+            else if (rest % 3 == 1)
+                I.value |= 1u << j;
+        }
+        primes.push_back(I);
+    }
+
+    return primes;
+}
+
+/*
+ * The prime implicant table: a row for each minterm and a column for each
+ * prime, kept as a bitset of rows per column and a list of columns per row.
+ */
+struct PrimeTable {
+    size_t rows;
+    std::vector<std::vector<uint64_t>> columns;
+    std::vector<std::vector<uint32_t>> row_columns;
+    /* cost of each column: one cube, then its literals to break ties */
+    std::vector<uint64_t> cost;
+};
+
+static const uint64_t CUBE_COST = 1 << 10;
+
+/* branches of the cover search before it settles for the best so far */
+static const uint64_t MINIMIZE_BUDGET = 10000;
+
+PrimeTable
+prime_table (const TruthTable &T, const std::vector<Implicant> &primes)
+{
+    PrimeTable P;
+    std::vector<int32_t> row(T.bits.size() * 64, -1);
+    size_t words;
+
+    P.rows = 0;
+    for (uint64_t m = 0; m < ((uint64_t) 1 << T.vars.size()); m++)
+        if (T.value(m))
+            row[m] = P.rows++;
+
+    words = (P.rows + 63) / 64;
+    P.row_columns.resize(P.rows);
+    for (size_t c = 0; c < primes.size(); c++) {
+        const Implicant &I = primes[c];
+        std::vector<uint64_t> bits(words, 0);
+        /* every minterm of the prime, by walking the subsets of its dashes */
+        uint32_t s = 0;
+        do {
+            int32_t r = row[I.value | s];
+            bits[r / 64] |= 1ULL << (r % 64);
+            P.row_columns[r].push_back(c);
+            s = (s - I.dashes) & I.dashes;
+        } while (s != 0);
+        P.columns.push_back(bits);
+        P.cost.push_back(CUBE_COST + I.size(T.vars.size()));
+    }
+
+    return P;
+}
+
+/*
+ * The covering problem over the prime table. Before searching, the table is
+ * cut down to its cyclic core: essential primes (the only column of some row)
+ * are taken, a row whose columns include every column of another row is
+ * dropped since covering the other covers it too, and a column whose rows
+ * are all covered by a column no more expensive is dropped. Only the rows
+ * and columns which changed since the table was last cut down are looked at
+ * again: a row which lost a column may now be essential or inside another
+ * row, and a column which lost a row may now be inside another column.
+ *
+ * What is left is searched by branch and bound, starting from a greedy
+ * cover so there is always one to fall back on. The row with the fewest
+ * columns is branched on and once a column has been tried it is excluded
+ * from the branches after it, so no cover is visited twice. A branch is cut
+ * when its cost plus a lower bound -- one cube for each of a set of rows
+ * which share no columns -- can't beat the best cover found so far.
+ */
+struct CoverSearch {
+    const PrimeTable &P;
+    /* columns which haven't been dropped or excluded */
+    std::vector<bool> active;
+    std::vector<uint32_t> chosen, best;
+    uint64_t best_cost;
+    /* branches left before settling for the best cover found */
+    uint64_t budget;
+    std::vector<uint32_t> used;
+    uint32_t stamp;
+
+    CoverSearch (const PrimeTable &P, uint64_t budget)
+        : P(P)
+        , active(P.columns.size(), true)
+        , best_cost(UINT64_MAX)
+        , budget(budget)
+        , used(P.columns.size(), 0)
+        , stamp(0)
+    { }
+
+    static bool
+    has (const std::vector<uint64_t> &bits, size_t i)
+    {
+        return (bits[i / 64] >> (i % 64)) & 1;
+    }
+
+    static void
+    unset (std::vector<uint64_t> &bits, size_t i)
+    {
+        bits[i / 64] &= ~(1ULL << (i % 64));
+    }
+
+    void
+    take (std::vector<uint64_t> &uncovered, uint64_t &cost, uint32_t c)
+    {
+        for (size_t w = 0; w < uncovered.size(); w++)
+            uncovered[w] &= ~P.columns[c][w];
+        chosen.push_back(c);
+        cost += P.cost[c];
+    }
+
+    /* the active columns of row r */
+    size_t
+    width (size_t r) const
+    {
+        size_t n = 0;
+        for (auto c : P.row_columns[r])
+            n += active[c];
+        return n;
+    }
+
+    /* are the uncovered rows of column c all rows of column d */
+    bool
+    within (const std::vector<uint64_t> &uncovered, uint32_t c, uint32_t d)
+        const
+    {
+        for (size_t w = 0; w < uncovered.size(); w++)
+            if (uncovered[w] & P.columns[c][w] & ~P.columns[d][w])
+                return false;
+        return true;
+    }
+
+    /*
+     * The uncovered rows other than r whose columns include every column of
+     * r, by ANDing its columns together over only the words still non-zero.
+     */
+    void
+    rows_over (const std::vector<uint64_t> &uncovered,
+               size_t r,
+               std::vector<uint32_t> &words,
+               std::vector<uint64_t> &over) const
+    {
+        bool first = true;
+
+        for (auto c : P.row_columns[r]) {
+            size_t kept = 0;
+            if (!active[c])
+                continue;
+            if (first) {
+                words.clear();
+                for (size_t w = 0; w < uncovered.size(); w++) {
+                    over[w] = uncovered[w] & P.columns[c][w];
+                    if (over[w])
+                        words.push_back(w);
+                }
+                first = false;
+                continue;
+            }
+            for (auto w : words) {
+                over[w] &= P.columns[c][w];
+                if (over[w])
+                    words[kept++] = w;
+            }
+            words.resize(kept);
+        }
+        for (auto w : words)
+            if (w == r / 64)
+                over[w] &= ~(1ULL << (r % 64));
+    }
+
+    /*
+     * Cut the table down until nothing changes, starting from the rows in
+     * `rows' and the columns in `columns'. The columns dropped are added to
+     * `dropped' so they can be restored.
+     */
+    void
+    reduce (std::vector<uint64_t> &uncovered,
+            uint64_t &cost,
+            std::vector<uint64_t> &rows,
+            std::vector<bool> &columns,
+            std::vector<uint32_t> &dropped)
+    {
+        std::vector<uint64_t> over(uncovered.size());
+        std::vector<uint32_t> words;
+        bool changed = true;
+
+        while (changed) {
+            changed = false;
+
+            for (size_t w = 0; w < rows.size(); w++) {
+                while (rows[w] & uncovered[w]) {
+                    size_t r = w * 64 + __builtin_ctzll(rows[w] & uncovered[w]);
+                    size_t n = width(r);
+                    unset(rows, r);
+
+                    /* a row left without columns is for branch to find */
+                    if (n == 0)
+                        continue;
+
+                    if (n == 1) {
+                        for (auto c : P.row_columns[r]) {
+                            if (!active[c])
+                                continue;
+                            take(uncovered, cost, c);
+                            /* every column may have lost rows */
+                            for (size_t d = 0; d < columns.size(); d++)
+                                columns[d] = active[d];
+                        }
+                        changed = true;
+                        continue;
+                    }
+
+                    /* of identical rows only the first is kept */
+                    rows_over(uncovered, r, words, over);
+                    for (auto v : words) {
+                        for (uint64_t m = over[v]; m; m &= m - 1) {
+                            size_t o = v * 64 + __builtin_ctzll(m);
+                            size_t gone = o;
+                            if (o < r && width(o) == n)
+                                gone = r;
+                            if (!has(uncovered, gone))
+                                continue;
+                            unset(uncovered, gone);
+                            for (auto c : P.row_columns[gone])
+                                if (active[c])
+                                    columns[c] = true;
+                            changed = true;
+                        }
+                    }
+                }
+            }
+
+            /* a column can only be within the columns of its own rows */
+            for (uint32_t c = 0; c < columns.size(); c++) {
+                size_t r = P.rows;
+                bool inside = false;
+                if (!columns[c] || !active[c])
+                    continue;
+                columns[c] = false;
+                for (size_t w = 0; w < uncovered.size() && r == P.rows; w++)
+                    if (uncovered[w] & P.columns[c][w])
+                        r = w * 64 + __builtin_ctzll(uncovered[w] &
+                                                     P.columns[c][w]);
+                inside = r == P.rows;
+                for (size_t i = 0; !inside && i < P.row_columns[r].size();
+                     i++) {
+                    uint32_t d = P.row_columns[r][i];
+                    if (d == c || !active[d] || P.cost[d] > P.cost[c])
+                        continue;
+                    /* of columns within each other the first is kept */
+                    if (P.cost[d] == P.cost[c] && d > c &&
+                        within(uncovered, d, c))
+                        continue;
+                    inside = within(uncovered, c, d);
+                }
+                if (!inside)
+                    continue;
+                active[c] = false;
+                dropped.push_back(c);
+                for (size_t w = 0; w < rows.size(); w++)
+                    rows[w] |= uncovered[w] & P.columns[c][w];
+                changed = true;
+            }
+        }
+    }
+
+    /* rows which share no columns, taking the narrowest rows first */
+    uint64_t
+    lower_bound (const std::vector<uint64_t> &uncovered)
+    {
+        std::vector<std::pair<size_t, size_t>> rows;
+        uint64_t bound = 0;
+
+        for (size_t w = 0; w < uncovered.size(); w++) {
+            for (uint64_t m = uncovered[w]; m; m &= m - 1) {
+                size_t r = w * 64 + __builtin_ctzll(m);
+                rows.push_back(std::make_pair(width(r), r));
+            }
+        }
+        std::sort(rows.begin(), rows.end());
+
+        stamp++;
+        for (auto &row : rows) {
+            bool disjoint = true;
+            for (auto c : P.row_columns[row.second])
+                if (active[c] && used[c] == stamp)
+                    disjoint = false;
+            if (!disjoint)
+                continue;
+            for (auto c : P.row_columns[row.second])
+                used[c] = stamp;
+            bound += CUBE_COST;
+        }
+        return bound;
+    }
+
+    /*
+     * Search below a table which was cut down before the rows in `rows' lost
+     * columns and the columns in `columns' lost rows.
+     */
+    void
+    search (std::vector<uint64_t> uncovered,
+            uint64_t cost,
+            std::vector<uint64_t> &rows,
+            std::vector<bool> &columns)
+    {
+        std::vector<uint32_t> dropped;
+        size_t mark = chosen.size();
+
+        if (budget == 0)
+            return;
+        budget--;
+
+        reduce(uncovered, cost, rows, columns, dropped);
+        branch(uncovered, cost);
+
+        chosen.resize(mark);
+        for (auto c : dropped)
+            active[c] = true;
+    }
+
+    void
+    branch (const std::vector<uint64_t> &uncovered, uint64_t cost)
+    {
+        std::vector<uint32_t> excluded;
+        std::vector<uint64_t> rows(uncovered.size(), 0);
+        std::vector<bool> columns;
+        size_t pick = P.rows, least = SIZE_MAX;
+
+        for (size_t r = 0; r < P.rows; r++) {
+            if (!has(uncovered, r))
+                continue;
+            size_t n = width(r);
+            if (n < least) {
+                least = n;
+                pick = r;
+            }
+        }
+
+        if (pick == P.rows) {
+            if (cost < best_cost) {
+                best_cost = cost;
+                best = chosen;
+            }
+            return;
+        }
+
+        /* a row left without columns can't be covered */
+        if (least == 0)
+            return;
+
+        if (cost + lower_bound(uncovered) >= best_cost)
+            return;
+
+        /* try the columns covering the most rows first */
+        std::vector<std::pair<size_t, uint32_t>> order;
+        for (auto c : P.row_columns[pick]) {
+            size_t gain = 0;
+            if (!active[c])
+                continue;
+            for (size_t w = 0; w < uncovered.size(); w++)
+                gain += __builtin_popcountll(uncovered[w] & P.columns[c][w]);
+            order.push_back(std::make_pair(gain, c));
+        }
+        std::sort(order.begin(), order.end(),
+                  [&](const std::pair<size_t, uint32_t> &a,
+                      const std::pair<size_t, uint32_t> &b) {
+            if (a.first != b.first)
+                return a.first > b.first;
+            return P.cost[a.second] < P.cost[b.second];
+        });
+
+        /*
+         * Taking a column may leave any column with fewer rows, and the rows
+         * of the columns excluded so far have fewer columns.
+         */
+        for (auto &o : order) {
+            std::vector<uint64_t> left(uncovered);
+            std::vector<uint64_t> changed(rows);
+            uint64_t with = cost;
+            size_t mark = chosen.size();
+            take(left, with, o.second);
+            columns = active;
+            search(left, with, changed, columns);
+            chosen.resize(mark);
+            active[o.second] = false;
+            excluded.push_back(o.second);
+            for (size_t w = 0; w < rows.size(); w++)
+                rows[w] |= P.columns[o.second][w];
+        }
+
+        for (auto c : excluded)
+            active[c] = true;
+    }
+
+    /*
+     * A cover made by taking the column covering the most rows, cheapest
+     * first, until every row is covered.
+     */
+    void
+    greedy (std::vector<uint64_t> uncovered)
+    {
+        uint64_t cost = 0;
+
+        for (;;) {
+            size_t most = 0;
+            uint32_t pick = 0;
+            for (uint32_t c = 0; c < P.columns.size(); c++) {
+                size_t gain = 0;
+                for (size_t w = 0; w < uncovered.size(); w++)
+                    gain += __builtin_popcountll(uncovered[w] &
+                                                 P.columns[c][w]);
+                if (gain > most || (gain == most && gain > 0 &&
+                                    P.cost[c] < P.cost[pick])) {
+                    most = gain;
+                    pick = c;
+                }
+            }
+            if (most == 0)
+                break;
+            take(uncovered, cost, pick);
+        }
+        best = chosen;
+        best_cost = cost;
+        chosen.clear();
+    }
+
+    /*
+     * The cheapest cover of the rows in `uncovered' if the search finishes
+     * within its budget, otherwise the best one found.
+     */
+    void
+    solve (const std::vector<uint64_t> &uncovered)
+    {
+        std::vector<uint64_t> rows(uncovered);
+        std::vector<bool> columns(P.columns.size(), true);
+
+        greedy(uncovered);
+        search(uncovered, 0, rows, columns);
+    }
+};
+
+/*
+ * A small sum of products of N. Primes are generated by Quine-McCluskey and
+ * then the fewest (and then smallest) primes covering every minterm are
+ * chosen. The search is exact unless it runs through `budget' branches, in
+ * which case the best cover found so far, at worst a greedy one, is
+ * returned.
+ */
+Cover
+minimum_cover (const Store &S, NodeId N, uint64_t budget)
+{
+    TruthTable T = truth_table(S, N);
+    std::vector<Implicant> primes;
+    Cover C(OR);
+
+    assert(T.vars.size() <= MAX_EXACT_VARS);
+
+    primes = prime_implicants(T);
+    if (primes.empty())
+        return C;
+
+    PrimeTable P = prime_table(T, primes);
+    CoverSearch search(P, budget);
+    std::vector<uint64_t> all((P.rows + 63) / 64, ~0ULL);
+    if (P.rows % 64)
+        all.back() = (1ULL << (P.rows % 64)) - 1;
+    search.solve(all);
+
+    for (auto c : search.best) {
+        const Implicant &I = primes[c];
+        Cube cube;
+        for (size_t j = 0; j < T.vars.size(); j++) {
+            if ((I.dashes >> j) & 1)
+                continue;
+            cube.add(T.vars[j], !((I.value >> j) & 1));
+        }
+        C.add(cube);
+    }
+
+    C.canonical();
+    return C;
+}
+
+/*
+ * A sum of products of N from the cover search when it has few enough
+ * variables, otherwise espresso's.
+ */
+NodeId
+minimize (Store &S, NodeId N)
+{
+    Cover C;
+
+    if (support(S, N).size() <= MAX_EXACT_VARS)
+        return from_cover(S, minimum_cover(S, N, MINIMIZE_BUDGET));
+
+    N = to_dnf(S, N);
+    if (!to_cover(S, N, OR, C))
+        return N;
+    espresso(C, ESPRESSO_ITERATIONS);
+    return from_cover(S, C);
+}
+
+#endif
@@ -3,45 +3,163 @@
 
 #include <vector>
 #include <string>
-#include <set>
+#include <algorithm>
+#include <cstdint>
+#include "Symbols.hpp"
+#include "Arena.hpp"
+#include "Flat.hpp"
+
+typedef enum NodeType {
+    AND, OR, NOT, VAR, TRUE, FALSE
+} NodeType;
+
+/*
+ * Variables are indices rather than names, see Symbols. 'A'-'Z' are 0-25 and
+ * 'a'-'z' are 26-51 so that comparing indices orders variables the same way
+ * as comparing their characters.
+ */
+uint32_t
+var_index (const char c)
+{
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A';
+    return c - 'a' + 26;
+}
+
+std::string
+var_name (const uint32_t var)
+{
+    return SYMBOLS.name(var);
+}
+
+#ifdef NODE_COUNTERS
+/* every copy and move of a node, for the benchmark build */
+static uint64_t NODE_COPIES = 0;
+static uint64_t NODE_MOVES = 0;
+#define COUNT_NODE(counter) (counter++)
+#else
+#define COUNT_NODE(counter)
+#endif
+
+struct Node;
+
+/* the children of a node, a sorted array from the current arena */
+typedef FlatSet<Node, std::less<Node>, ArenaAllocator<Node>> NodeSet;
 
 struct Node {
-    std::string type;
-    std::set<Node> children;
-    std::string logical;
+    NodeType type;
+    /* only for VAR, the variable's index and whether it is negated */
+    bool negated;
+    uint32_t var;
+    /* the longest path down to a leaf, 0 for the leaves */
+    uint32_t depth;
+    NodeSet children;
+    /*
+     * Structural hash of the node. Children are folded in with a sum so it
+     * doesn't depend on the order they are added and each add_child updates
+     * it in constant time.
+     */
+    uint64_t hash;
+    /*
+     * Where the node sorts: whether it is a leaf or which operator, how many
+     * children it has and the rank of its smallest leaf. Nodes with the same
+     * key sort by their children in order, so compound expressions of the
+     * same size print in alphabetical order of their leaves. It is kept up
+     * to date by add_child so that ordering two nodes is usually one integer
+     * compare.
+     */
+    uint64_t key;
+
+    Node ()
+        : type(OR)
+        , negated(false)
+        , var(0)
+        , depth(0)
+        , hash(seed(OR, 0, false))
+        , key(make_key(OR, 0, UINT32_MAX))
+    { }
 
-    Node () 
-        : type("+")
+    Node (const NodeType type)
+        : type(type)
+        , negated(false)
+        , var(0)
+        , depth(0)
+        , hash(seed(type, 0, false))
+        , key(make_key(type, 0, leaf_rank(type, 0, false)))
     { }
 
-    Node (const char c)
-        : type(std::string(1, c))
+    Node (const uint32_t var, const bool negated)
+        : type(VAR)
+        , negated(negated)
+        , var(var)
+        , depth(0)
+        , hash(seed(VAR, var, negated))
+        , key(make_key(VAR, 0, leaf_rank(VAR, var, negated)))
+    { }
+
+    Node (const Node &other)
+        : type(other.type)
+        , negated(other.negated)
+        , var(other.var)
+        , depth(other.depth)
+        , children(other.children)
+        , hash(other.hash)
+        , key(other.key)
     {
-        this->logical = this->logical_str();
+        COUNT_NODE(NODE_COPIES);
     }
 
-    Node (std::string type) 
-        : type(type)
+    /* taking the children over from a node which is going away is O(1) */
+    Node (Node &&other) noexcept
+        : type(other.type)
+        , negated(other.negated)
+        , var(other.var)
+        , depth(other.depth)
+        , children(std::move(other.children))
+        , hash(other.hash)
+        , key(other.key)
     {
-        this->logical = this->logical_str();
+        COUNT_NODE(NODE_MOVES);
     }
 
-    Node (const Node &other) 
-        : type(other.type)
-        , children(other.children)
-        , logical(other.logical)
-    { }
+    Node &
+    operator= (const Node &other)
+    {
+        COUNT_NODE(NODE_COPIES);
+        type = other.type;
+        negated = other.negated;
+        var = other.var;
+        depth = other.depth;
+        children = other.children;
+        hash = other.hash;
+        key = other.key;
+        return *this;
+    }
 
-    std::set<std::string>
+    Node &
+    operator= (Node &&other) noexcept
+    {
+        COUNT_NODE(NODE_MOVES);
+        type = other.type;
+        negated = other.negated;
+        var = other.var;
+        depth = other.depth;
+        children = std::move(other.children);
+        hash = other.hash;
+        key = other.key;
+        return *this;
+    }
+
+    NodeSet
     values () const
     {
-        std::set<std::string> S;
+        NodeSet S;
 
         for (auto &child : this->children) {
             if (!child.is_operator()) {
-                S.insert(child.type);
+                S.insert(child);
             } else {
-                std::set<std::string> vals = child.values();
+                NodeSet vals = child.values();
                 for (auto &v : vals)
                     S.insert(v);
             }
@@ -50,7 +168,7 @@ struct Node {
     }
 
     bool
-    contains (const std::string type) const
+    contains (const NodeType type) const
     {
         if (this->type == type)
             return true;
@@ -67,7 +185,7 @@ struct Node {
     is_cnf () const
     {
         for (auto &child : this->children)
-            if (child.contains("*"))
+            if (child.contains(AND))
                 return false;
         return true;
     }
@@ -76,7 +194,7 @@ struct Node {
     is_dnf () const
     {
         for (auto &child : this->children)
-            if (child.contains("+"))
+            if (child.contains(OR))
                 return false;
         return true;
     }
@@ -84,54 +202,33 @@ struct Node {
     bool
     is_operator () const
     {
-        return (type == "+" || type == "*" || type == "!");
+        return (type == AND || type == OR || type == NOT);
+    }
+
+    /* the rank of the smallest leaf in the tree */
+    uint32_t
+    lead () const
+    {
+        return (uint32_t) key;
     }
 
     /*
-     * Do a string comparison of each tree's logical string for sets so that
-     * ordering will always be deterministic between sets of similar but not
-     * equal nodes.
-     * This sorts variables by their value first and then by their negation
-     * second.
+     * Compound expressions are ordered by their type, their size, their
+     * smallest leaf and then their hash, which is all in `key' and `hash'.
+     * Only when all of those are equal, which for different nodes takes a
+     * hash collision, do we walk the children, so ordering will always be
+     * deterministic between sets of similar but not equal nodes without
+     * building any strings. This sorts constants first, then variables by
+     * their index and then by their negation.
      */
     bool
     operator< (const Node &other) const
     {
-        bool a_negated, b_negated;
-        std::string A = this->logical;
-        std::string B = other.logical;
-
-        /* Put variables before compound expressions */
-        if (!this->is_operator() && other.is_operator())
-            return true;
-        if (this->is_operator() && !other.is_operator())
-            return false;
-        /* If two compound expressions, the smaller ones go first */
-        if (this->is_operator() && other.is_operator())
-            return A < B;
-
-        a_negated = b_negated = false;
-
-        if (A[0] == '!') {
-            a_negated = true;
-            A = std::string(1, A[1]);
-        }
-        if (B[0] == '!') {
-            b_negated = true;
-            B = std::string(1, B[1]);
-        }
-
-        /* If equal, negation is ordered first */
-        if (A == B && a_negated && !b_negated)
-            return true;
-        if (A == B && !a_negated && b_negated)
-            return false;
-        /* this makes sure equal variables are considered equal */
-        if (A == B && a_negated && b_negated)
-            return false;
-
-        /* in all other cases sort by variable name */
-        return A < B;
+        if (this->key != other.key)
+            return this->key < other.key;
+        return std::lexicographical_compare(
+                this->children.begin(), this->children.end(),
+                other.children.begin(), other.children.end());
     }
 
     bool
@@ -143,7 +240,15 @@ struct Node {
     bool
     operator== (const Node &other) const
     {
-        return this->logical == other.logical;
+        if (this->key != other.key || this->hash != other.hash ||
+            this->depth != other.depth)
+            return false;
+        if (this->type == VAR)
+            return this->var == other.var && this->negated == other.negated;
+        if (this->children.size() != other.children.size())
+            return false;
+        return std::equal(this->children.begin(), this->children.end(),
+                          other.children.begin());
     }
 
     /* 
@@ -153,27 +258,46 @@ struct Node {
      * single child.
      * If the given child is the same type as the parent, then we can directly
      * add all its children and values to the parent.
+     *
+     * `child' is our own copy, so the grandchildren lifted out of it are moved
+     * and pass a child which is done with by std::move to copy nothing.
      */
     void
     add_reduction (Node child)
     {
-        if (!child.is_operator() || child.type == "!") {
-            this->add_child(child);
+        if (!child.is_operator() || child.type == NOT) {
+            this->add_child(std::move(child));
         } else if (child.type == this->type) {
             for (auto &grandchild : child.children)
-                this->add_reduction(grandchild);
+                this->add_reduction(take(grandchild));
         } else if (child.children.size() == 1) {
-            this->add_reduction(*child.children.begin());
+            this->add_reduction(take(*child.children.begin()));
         } else {
-            this->add_child(child);
+            this->add_child(std::move(child));
         }
     }
 
     void
     add_child (Node child)
     {
-        this->children.insert(child);
-        this->logical_str();
+        uint64_t h = child.hash;
+        uint32_t lead = std::min(this->lead(), child.lead());
+        uint32_t depth = child.depth + 1;
+        if (this->children.insert(std::move(child)).second) {
+            this->hash += spread(h);
+            this->key = make_key(type, children.size(), lead);
+            this->depth = std::max(this->depth, depth);
+        }
+    }
+
+    /*
+     * Move a child out of a node which is going away. Its set is never
+     * searched again, only destroyed, so the child needn't keep its place.
+     */
+    static Node &&
+    take (const Node &child)
+    {
+        return std::move(const_cast<Node &>(child));
     }
 
     void
@@ -185,10 +309,10 @@ struct Node {
         for (int i = 0; i < tab; i++)
             printf("   ");
 
-        printf("%s\n", N.type.c_str());
+        printf("%s\n", N.type_str().c_str());
 
         tab++;
-        for (auto c : N.children)
+        for (auto &c : N.children)
             c.print_tree();
         tab--;
 
@@ -196,42 +320,112 @@ struct Node {
             printf("-------------------------------\n");
     }
 
+    /* the operator or the leaf itself as it is printed */
     std::string
-    logical_str ()
+    type_str () const
     {
-        this->logical = logical_str(false);
-        return this->logical;
+        switch (this->type) {
+            case AND:   return "*";
+            case OR:    return "+";
+            case NOT:   return "!";
+            case TRUE:  return "1";
+            case FALSE: return "0";
+            default:    break;
+        }
+        return (this->negated ? "!" : "") + var_name(this->var);
     }
 
+    /*
+     * The expression as a string. This is built from the whole tree every
+     * time so only call it to output something.
+     */
     std::string
-    logical_str (const bool print_prod) const
+    logical_str (const bool print_prod = false) const
     {
         std::string str;
         const Node &N = *this;
 
         if (!this->is_operator()) {
-            return N.type;
+            return N.type_str();
         }
 
         /* negation just adds the obvious expression negation */
-        if (N.type == "!") {
+        if (N.type == NOT) {
             return str + "!(" + N.children.begin()->logical_str(print_prod) + ")";
         }
 
-        for (auto &child : N.children) {
-            if (child.is_operator())
+        /* names longer than a letter can't just run into their neighbours */
+        bool star = print_prod;
+        for (auto &child : N.children)
+            if (N.type == AND && child.type == VAR &&
+                var_name(child.var).size() > 1)
+                star = true;
+
+        for (auto it = N.children.begin(); it != N.children.end(); it++) {
+            bool last = (std::next(it) == N.children.end());
+            if (it->is_operator())
                 str += "(";
-            str += child.logical_str(print_prod);
-            if (child.is_operator())
+            str += it->logical_str(print_prod);
+            if (it->is_operator())
                 str += ")";
-            if (N.type == "+" && child != *std::prev(N.children.end()))
-                str += N.type;
-            if (print_prod && N.type == "*" && child != *std::prev(N.children.end()))
-                str += N.type;
+            if (N.type == OR && !last)
+                str += "+";
+            if (star && N.type == AND && !last)
+                str += "*";
         }
 
         return str;
     }
+
+private:
+    /* splitmix64's finalizer, so that sums of child hashes don't collide */
+    static uint64_t
+    spread (uint64_t h)
+    {
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+        return h;
+    }
+
+    static uint64_t
+    seed (const NodeType type, const uint32_t var, const bool negated)
+    {
+        return spread(((uint64_t) type << 40) | ((uint64_t) var << 1) | negated);
+    }
+
+    /*
+     * Leaves sort before every operator and the operators in the order of
+     * their type, then by size. A size past 2^28 is cut off there and left
+     * to the hash, which still orders them but no longer by size.
+     */
+    static uint64_t
+    make_key (const NodeType type, const size_t size, const uint32_t lead)
+    {
+        uint64_t kind = 0;
+
+        if (type == AND || type == OR || type == NOT)
+            kind = 1 + type;
+        return (kind << 60) |
+               ((uint64_t) std::min(size, (size_t) 0xfffffff) << 32) | lead;
+    }
+
+    /*
+     * '0' and '1' sort before any variable, variables by their index and if
+     * equal, negation is ordered first. Operators have no rank of their own.
+     */
+    static uint32_t
+    leaf_rank (const NodeType type, const uint32_t var, const bool negated)
+    {
+        switch (type) {
+            case FALSE: return 0;
+            case TRUE:  return 1;
+            case VAR:   return 2 + var * 2 + !negated;
+            default:    return UINT32_MAX;
+        }
+    }
 };
 
 #endif
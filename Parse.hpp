@@ -2,7 +2,6 @@
 #define PARSE_HPP
 
 #include <iostream>
-#include <sstream>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -11,223 +10,342 @@
 #include <cassert>
 #include "Node.hpp"
 
-static std::stringstream INPUT;
-static int LOOKAHEAD;
-
 /*
- * 1 character look ahead
+ * A recursive descent parser for one expression. It reads straight out of
+ * the caller's buffer, which must outlive the parse, and keeps everything
+ * else in the object so several can parse at once, e.g. one for each thread.
+ *
+ * The first error is kept in `error' and every look after it sees the end of
+ * the input, so the descent unwinds on its own and `parse' returns false.
  */
-int
-look ()
-{
-    return LOOKAHEAD;
-}
+struct Parser {
+    const char *input;
+    size_t length;
+    /* the index just past the lookahead character */
+    size_t pos;
+    /* the end of the run of plain letters the lookahead is in, if any */
+    size_t letters;
+    int lookahead;
+    std::string error;
 
-/*
- * Arbitrary character look ahead.
- */
-int
-look_n (int count)
-{
-    std::vector<int> read;
-    /* save all characters read including whitespace */
-    for (int i = 0; i < count; i++) {
-        do {
-            read.push_back(INPUT.get());
-        } while (isspace(read.back()));
+    Parser ()
+        : input("")
+        , length(0)
+        , pos(0)
+        , letters(0)
+        , lookahead(EOF)
+    { }
+
+    Parser (const char *input, size_t length)
+    {
+        set_input(input, length);
     }
-    /* and put them back */
-    for (int i = (int) read.size() - 1; i >= 0; i--) {
-        INPUT.putback(read[i]);
+
+    void
+    set_input (const char *input, size_t length)
+    {
+        this->input = input;
+        this->length = length;
+        this->pos = 0;
+        this->letters = 0;
+        this->lookahead = EOF;
+        this->error.clear();
     }
-    return read.back();
-}
 
-int
-next ()
-{
-    do {
-        LOOKAHEAD = INPUT.get();
-    } while (isspace(LOOKAHEAD));
-    return LOOKAHEAD;
-}
+    /* the string is not copied so it has to stay as it is until parsed */
+    void
+    set_input (const std::string &str)
+    {
+        set_input(str.data(), str.size());
+    }
 
-void
-unexpected (char c)
-{
-    fprintf(stderr, "Unexpected character '%c'\n", c);
-    exit(1);
-}
+    /*
+     * Parse the whole input into N. Returns false with the reason in `error'
+     * if it isn't an expression.
+     */
+    bool
+    parse (Node &N)
+    {
+        pos = 0;
+        letters = 0;
+        error.clear();
+        next();
+        N = expr();
+        /* an expression ends at a ')' which has nothing to close */
+        if (look() != EOF)
+            unexpected(look());
+        return error.empty();
+    }
 
-void
-match (char c)
-{
-    if (look() != c) {
-        fprintf(stderr, "Expected character '%c' got '%c'\n", c, look());
-        exit(1);
+    /*
+     * 1 character look ahead
+     */
+    int
+    look () const
+    {
+        return lookahead;
     }
-    next();
-}
 
-Node var ();
-Node sub ();
-Node negate ();
-Node prod ();
-Node expr ();
+    /*
+     * The character `count' past the look ahead, skipping whitespace.
+     */
+    int
+    look_n (int count) const
+    {
+        size_t i = pos;
 
-bool
-is_var ()
-{
-    if (look() == '!')
-        return isalpha(look_n(1));
-    return isalpha(look());
-}
+        if (lookahead == EOF)
+            return EOF;
+        for (int n = 0; n < count; n++) {
+            while (i < length && isspace((unsigned char) input[i]))
+                i++;
+            if (i >= length)
+                return EOF;
+            i++;
+        }
+        return (unsigned char) input[i - 1];
+    }
 
-/*
- * atom = [01]
- */
-Node
-atom ()
-{
-    int c = look();
-    if (!(c == '0' || c == '1')) {
-        fprintf(stderr, "Expected atomic 0 or 1 instead got '%c'\n", c);
-        exit(1);
+    int
+    next ()
+    {
+        while (pos < length && isspace((unsigned char) input[pos]))
+            pos++;
+        lookahead = (pos < length) ? (unsigned char) input[pos++] : EOF;
+        return lookahead;
     }
-    match(c);
-    return Node(c);
-}
 
-/*
- * var = !?[A-Za-z]
- */
-Node
-var ()
-{
-    std::string v;
+    /* keep the first error and stop reading */
+    void
+    fail (const std::string &message)
+    {
+        if (error.empty())
+            error = message + " at " + std::to_string(pos);
+        pos = length;
+        lookahead = EOF;
+    }
 
-    if (look() == '!') {
-        match('!');
-        v += '!';
+    void
+    unexpected (int c)
+    {
+        if (c == EOF)
+            fail("Unexpected end of input");
+        else
+            fail(std::string("Unexpected character '") + (char) c + "'");
     }
-    if (!is_var()) {
-        fprintf(stderr, "Expected character instead got '%c'\n", look());
-        exit(1);
+
+    void
+    match (char c)
+    {
+        if (look() != c) {
+            if (look() == EOF)
+                fail(std::string("Expected character '") + c +
+                     "' got end of input");
+            else
+                fail(std::string("Expected character '") + c + "' got '" +
+                     (char) look() + "'");
+            return;
+        }
+        next();
     }
-    v += look();
-    match(look());
 
-    return Node(v);
-}
+    bool
+    is_var () const
+    {
+        if (look() == '!')
+            return isalpha(look_n(1));
+        return look() != EOF && isalpha(look());
+    }
 
-/*
- * <sub> = (<expr>)
- */
-Node
-sub ()
-{
-    match('(');
-    Node N = expr();
-    match(')');
-    return N;
-}
+    /*
+     * atom = [01]
+     */
+    Node
+    atom ()
+    {
+        int c = look();
+        if (!(c == '0' || c == '1')) {
+            unexpected(c);
+            return Node(FALSE);
+        }
+        match(c);
+        return Node(c == '1' ? TRUE : FALSE);
+    }
 
-/*
- * <negate> = !(<expr>)
- */
-Node
-negate ()
-{
-    Node N('!');
-    match('!');
-    match('(');
-    N.add_reduction(expr());
-    match(')');
-    assert(N.children.size() == 1);
-    return N;
-}
+    /*
+     * var = !?[A-Za-z] | !?[A-Za-z][A-Za-z0-9_]*
+     *
+     * A run of letters alone is a product of single letter variables as
+     * always, so `ab' is a and b. A run with a digit or an underscore in it
+     * is one identifier, e.g. req_valid or fifo3.
+     */
+    Node
+    var ()
+    {
+        bool negated = false;
+        size_t start, end;
+        bool identifier = false;
 
-/*
- * <prod> = <negate><prod> | <sub><prod> | <var><prod> | <atom><prod> | E
- */
-Node
-prod ()
-{
-    Node N('*');
-
-    while (1) {
-        if (look() == '!' && look_n(1) == '(')
-            N.add_child(negate());
-        else if (look() == '(')
-            N.add_reduction(sub());
-        else if (is_var())
-            N.add_child(var());
-        else if (look() == '0' || look() == '1')
-            N.add_child(atom());
-        else
+        if (look() == '!') {
+            match('!');
+            negated = true;
+        }
+        if (!is_var()) {
             unexpected(look());
+            return Node(FALSE);
+        }
 
-        /* a prod cannot begin with any of these */
-        if (look() == '+' || look() == ')' || look() == EOF)
-            break;
+        /* the lookahead is the character just before pos */
+        start = pos - 1;
+        for (end = pos; end < length && pos > letters; end++) {
+            char c = input[end];
+            if (c == '_' || isdigit((unsigned char) c))
+                identifier = true;
+            else if (!isalpha((unsigned char) c))
+                break;
+        }
+        if (!identifier)
+            letters = std::max(letters, end);
+
+        if (!identifier) {
+            char v = look();
+            match(v);
+            return Node(var_index(v), negated);
+        }
+        pos = end;
+        next();
+        return Node(SYMBOLS.intern(input + start, end - start), negated);
     }
 
-    return N;
-}
+    /*
+     * <sub> = (<expr>)
+     */
+    Node
+    sub ()
+    {
+        match('(');
+        Node N = expr();
+        match(')');
+        return N;
+    }
 
-/*
- * <expr> = <prod><expr> | <prod>+<expr> | E
- */
-Node
-expr ()
-{
-    /* use a sentinel value not in language to mark 'unset' */
-    Node N("@");
+    /*
+     * <negate> = !(<expr>)
+     */
+    Node
+    negate ()
+    {
+        Node N(NOT);
+        match('!');
+        match('(');
+        N.add_reduction(expr());
+        match(')');
+        assert(N.children.size() == 1);
+        return N;
+    }
 
-    do {
-        N.add_reduction(prod());
+    /*
+     * <prod> = <negate><prod> | <sub><prod> | <var><prod> | <atom><prod> | E
+     *
+     * with an optional '*' between any two of them.
+     */
+    Node
+    prod ()
+    {
+        Node N(AND);
 
-        /* 
-         * Anytime we find an disjunction ('+') then we make sure N has type
-         * '+'. Note that a disjunction can overwrite a conjunction but not
-         * vice-versa.
-         */
-        if (look() == '+') {
-            N.type = '+';
-            match('+');
-        } else if (N.type == "@") {
-            N.type = '*';
+        while (1) {
+            if (look() == '!' && look_n(1) == '(')
+                N.add_child(negate());
+            else if (look() == '(')
+                N.add_reduction(sub());
+            else if (is_var())
+                N.add_child(var());
+            else if (look() == '0' || look() == '1')
+                N.add_child(atom());
+            else
+                unexpected(look());
+
+            /* a prod cannot begin with any of these */
+            if (look() == '+' || look() == ')' || look() == EOF)
+                break;
+            if (look() == '*')
+                match('*');
         }
 
-        /* these tokens end an expr or a sub expr */
-        if (look() == EOF || look() == ')')
-            break;
-    } while (look() != EOF);
+        return N;
+    }
 
-    /* 
-     * if we have an expression of a single child, e.g. a or (b) or ((c+d))
-     * then make that child the root and return it
+    /*
+     * <expr> = <prod><expr> | <prod>+<expr> | E
      */
-    if (N.children.size() == 1)
-        return *N.children.begin();
+    Node
+    expr ()
+    {
+        std::vector<Node> prods;
+        NodeType type = AND;
 
-    return N;
-}
+        do {
+            prods.push_back(prod());
+
+            /*
+             * Anytime we find an disjunction ('+') then the expression has
+             * type '+'. Note that a disjunction can overwrite a conjunction
+             * but not vice-versa.
+             */
+            if (look() == '+') {
+                type = OR;
+                match('+');
+            }
 
+            /* these tokens end an expr or a sub expr */
+            if (look() == EOF || look() == ')')
+                break;
+        } while (look() != EOF);
+
+        /* a single product has nothing to merge so it is moved out whole */
+        if (prods.size() == 1 && prods[0].children.size() != 1)
+            return std::move(prods[0]);
+
+        Node N(type);
+        for (auto &P : prods)
+            N.add_reduction(std::move(P));
+
+        /*
+         * if we have an expression of a single child, e.g. a or (b) or
+         * ((c+d)) then make that child the root and return it
+         */
+        if (N.children.size() == 1)
+            return Node::take(*N.children.begin());
+
+        return N;
+    }
+};
+
+/* the parser for programs which only ever parse on one thread */
+static Parser PARSER;
+static std::string PARSER_INPUT;
+
+/*
+ * Parse what set_input was given, exiting with the error if it isn't an
+ * expression.
+ */
 Node
 parse_input ()
 {
-    /* set look to whitespace because 'next' loops until no whitespace */
-    LOOKAHEAD = ' ';
-    next();
-    return expr();
+    Node N;
+    if (!PARSER.parse(N)) {
+        fprintf(stderr, "%s\n", PARSER.error.c_str());
+        exit(1);
+    }
+    return N;
 }
 
 void
 set_input (std::string input)
 {
-    INPUT.clear();
-    INPUT.str(input);
+    PARSER_INPUT = input;
+    PARSER.set_input(PARSER_INPUT);
 }
 
 #endif
@@ -0,0 +1,172 @@
+#ifndef POOL_HPP
+#define POOL_HPP
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+
+/*
+ * A fixed number of workers running numbered jobs. Each worker has its own
+ * deque of jobs which it takes from the front, so it works through them in
+ * order, and once it is empty it steals from the back of the others' so no
+ * worker sits idle while another still has a queue. Jobs never make more
+ * jobs, so a worker is done when every deque is empty.
+ *
+ * The threads are started once with the pool and wait between runs, so a
+ * caller which runs many small rounds of jobs doesn't pay for starting them
+ * each time.
+ */
+struct Pool {
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> jobs;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    uint64_t steals;
+
+    /* what the threads wait on between runs */
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void (size_t, size_t)> *work;
+    /* counts the runs so a thread knows when there is a new one */
+    uint64_t round;
+    /* the threads still on the current run */
+    size_t running;
+    bool stopping;
+
+    Pool (size_t workers)
+        : steals(0)
+        , work(NULL)
+        , round(0)
+        , running(0)
+        , stopping(false)
+    {
+        for (size_t i = 0; i < std::max(workers, (size_t) 1); i++)
+            queues.emplace_back(new Queue());
+        for (size_t w = 1; w < queues.size(); w++)
+            threads.emplace_back([this, w] () { serve(w); });
+    }
+
+    ~Pool ()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &t : threads)
+            t.join();
+    }
+
+    size_t
+    workers () const
+    {
+        return queues.size();
+    }
+
+    /*
+     * Run work(job, worker) for each job in [0, count) and wait for them all.
+     * Jobs are dealt out round robin so the lowest numbered ones, which the
+     * caller probably wants first, start first on every worker.
+     */
+    void
+    run (size_t count, const std::function<void (size_t, size_t)> &work)
+    {
+        for (size_t job = 0; job < count; job++)
+            queues[job % workers()]->jobs.push_back(job);
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            this->work = &work;
+            running = threads.size();
+            round++;
+        }
+        wake.notify_all();
+
+        /* the calling thread is the first worker */
+        uint64_t stolen = drain(0, work);
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [this] () { return running == 0; });
+        steals += stolen;
+        this->work = NULL;
+    }
+
+private:
+    bool
+    take (size_t w, size_t &job)
+    {
+        std::lock_guard<std::mutex> guard(queues[w]->lock);
+        if (queues[w]->jobs.empty())
+            return false;
+        job = queues[w]->jobs.front();
+        queues[w]->jobs.pop_front();
+        return true;
+    }
+
+    bool
+    steal (size_t w, size_t &job)
+    {
+        for (size_t i = 1; i < workers(); i++) {
+            Queue &victim = *queues[(w + i) % workers()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.jobs.empty()) {
+                job = victim.jobs.back();
+                victim.jobs.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* worker w's thread, which drains the queues once for every run */
+    void
+    serve (size_t w)
+    {
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> guard(lock);
+
+        while (true) {
+            wake.wait(guard, [&] () { return stopping || round != seen; });
+            if (stopping)
+                return;
+            seen = round;
+            const std::function<void (size_t, size_t)> &job = *work;
+            guard.unlock();
+            uint64_t stolen = drain(w, job);
+            guard.lock();
+            steals += stolen;
+            if (--running == 0)
+                done.notify_one();
+        }
+    }
+
+    /* run jobs on worker w until there are none left anywhere */
+    uint64_t
+    drain (size_t w, const std::function<void (size_t, size_t)> &work)
+    {
+        uint64_t stolen = 0;
+        size_t job;
+
+        while (true) {
+            if (take(w, job)) {
+                work(job, w);
+            } else if (steal(w, job)) {
+                stolen++;
+                work(job, w);
+            } else {
+                return stolen;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,784 @@
+#ifndef SAT_HPP
+#define SAT_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+#include "Node.hpp"
+#include "Store.hpp"
+#include "Cube.hpp"
+#include "Truth.hpp"
+#include "Form.hpp"
+
+/*
+ * Literals are a variable shifted left once with the low bit set when it is
+ * negated, the same as the literals of the Tseitin encoding.
+ */
+typedef uint32_t Lit;
+
+static inline Lit
+literal (uint32_t var, bool negated)
+{
+    return (var << 1) | negated;
+}
+
+static const Lit NO_LIT = UINT32_MAX;
+static const uint32_t NO_CLAUSE = UINT32_MAX;
+
+typedef enum SatResult {
+    SATISFIABLE, UNSATISFIABLE, UNKNOWN
+} SatResult;
+
+/* conflicts before the first restart, scaled by the Luby sequence after */
+static const uint64_t RESTART_BASE = 100;
+
+/*
+ * A max-heap of variables by activity, so the next decision is the unassigned
+ * variable which has been in the most recent conflicts.
+ */
+struct VarHeap {
+    const std::vector<double> &activity;
+    std::vector<uint32_t> heap;
+    /* the index of each variable in the heap, UINT32_MAX if it isn't */
+    std::vector<uint32_t> index;
+
+    VarHeap (const std::vector<double> &activity)
+        : activity(activity)
+    { }
+
+    bool
+    empty () const
+    {
+        return heap.empty();
+    }
+
+    bool
+    contains (uint32_t v) const
+    {
+        return v < index.size() && index[v] != UINT32_MAX;
+    }
+
+    void
+    insert (uint32_t v)
+    {
+        if (v >= index.size())
+            index.resize(v + 1, UINT32_MAX);
+        if (contains(v))
+            return;
+        index[v] = heap.size();
+        heap.push_back(v);
+        up(index[v]);
+    }
+
+    /* the variable's activity went up */
+    void
+    raised (uint32_t v)
+    {
+        if (contains(v))
+            up(index[v]);
+    }
+
+    uint32_t
+    pop ()
+    {
+        uint32_t top = heap[0];
+        heap[0] = heap.back();
+        index[heap[0]] = 0;
+        heap.pop_back();
+        index[top] = UINT32_MAX;
+        if (!heap.empty())
+            down(0);
+        return top;
+    }
+
+private:
+    void
+    up (uint32_t i)
+    {
+        uint32_t v = heap[i];
+        while (i > 0 && activity[heap[(i - 1) / 2]] < activity[v]) {
+            heap[i] = heap[(i - 1) / 2];
+            index[heap[i]] = i;
+            i = (i - 1) / 2;
+        }
+        heap[i] = v;
+        index[v] = i;
+    }
+
+    void
+    down (uint32_t i)
+    {
+        uint32_t v = heap[i];
+        while (2 * i + 1 < heap.size()) {
+            uint32_t child = 2 * i + 1;
+            if (child + 1 < heap.size() &&
+                activity[heap[child + 1]] > activity[heap[child]])
+                child++;
+            if (activity[heap[child]] <= activity[v])
+                break;
+            heap[i] = heap[child];
+            index[heap[i]] = i;
+            i = child;
+        }
+        heap[i] = v;
+        index[v] = i;
+    }
+};
+
+/*
+ * A CDCL SAT solver in the style of MiniSat: two watched literals for unit
+ * propagation, VSIDS for picking decisions with the last polarity of each
+ * variable remembered, first-UIP clause learning with recursive minimization
+ * of the learned clause, Luby restarts and an activity based cut of the
+ * learned clauses at each restart.
+ */
+struct Solver {
+    struct Clause {
+        std::vector<Lit> lits;
+        bool learnt;
+        bool deleted;
+        double activity;
+    };
+
+    /* a clause watching the negation of this literal, and one of its others */
+    struct Watch {
+        uint32_t clause;
+        Lit blocker;
+    };
+
+    std::vector<Clause> clauses;
+    /* the clauses to visit when a literal becomes true */
+    std::vector<std::vector<Watch>> watches;
+    /* 1 when a literal is true, -1 when false, 0 when unassigned */
+    std::vector<int8_t> values;
+    std::vector<uint32_t> level;
+    std::vector<uint32_t> reason;
+    std::vector<bool> phase;
+    std::vector<double> activity;
+    VarHeap order;
+
+    std::vector<Lit> trail;
+    /* where each decision level starts in the trail */
+    std::vector<size_t> trail_lim;
+    size_t qhead;
+
+    double var_inc;
+    double clause_inc;
+    size_t learnts;
+    double max_learnts;
+    /* false once the clauses are unsatisfiable without any decisions */
+    bool ok;
+
+    std::vector<bool> model;
+    std::vector<Lit> failed;
+    uint64_t conflicts;
+    uint64_t decisions;
+    uint64_t propagations;
+
+    /* the first decisions of the current call to solve */
+    std::vector<Lit> assumptions;
+
+    /* scratch space for conflict analysis */
+    std::vector<bool> seen;
+    std::vector<Lit> to_clear;
+
+    Solver ()
+        : order(activity)
+        , qhead(0)
+        , var_inc(1)
+        , clause_inc(1)
+        , learnts(0)
+        , max_learnts(0)
+        , ok(true)
+        , conflicts(0)
+        , decisions(0)
+        , propagations(0)
+    { }
+
+    /* the heap refers to this solver's activity, so it can't be copied */
+    Solver (const Solver &) = delete;
+    Solver &operator= (const Solver &) = delete;
+
+    static uint32_t
+    var (Lit l)
+    {
+        return l >> 1;
+    }
+
+    size_t
+    vars () const
+    {
+        return level.size();
+    }
+
+    int8_t
+    value (Lit l) const
+    {
+        return values[l];
+    }
+
+    uint32_t
+    decision_level () const
+    {
+        return trail_lim.size();
+    }
+
+    /* make sure the variable v exists */
+    void
+    add_var (uint32_t v)
+    {
+        while (vars() <= v) {
+            uint32_t n = vars();
+            watches.resize(2 * (n + 1));
+            values.resize(2 * (n + 1), 0);
+            level.push_back(0);
+            reason.push_back(NO_CLAUSE);
+            phase.push_back(false);
+            activity.push_back(0);
+            seen.push_back(false);
+            order.insert(n);
+        }
+    }
+
+    /*
+     * Add a clause. Returns false if that makes the clauses unsatisfiable
+     * without a single decision.
+     */
+    bool
+    add_clause (std::vector<Lit> lits)
+    {
+        std::vector<Lit> kept;
+
+        assert(decision_level() == 0);
+        if (!ok)
+            return false;
+
+        for (auto l : lits)
+            add_var(var(l));
+        std::sort(lits.begin(), lits.end());
+        for (size_t i = 0; i < lits.size(); i++) {
+            /* a clause with x and !x or a true literal is always satisfied */
+            if (value(lits[i]) > 0 || (i > 0 && lits[i] == (lits[i - 1] ^ 1)))
+                return true;
+            if (value(lits[i]) < 0 || (i > 0 && lits[i] == lits[i - 1]))
+                continue;
+            kept.push_back(lits[i]);
+        }
+
+        if (kept.empty()) {
+            ok = false;
+        } else if (kept.size() == 1) {
+            assign(kept[0], NO_CLAUSE);
+            ok = (propagate() == NO_CLAUSE);
+        } else {
+            attach(kept, false);
+        }
+        return ok;
+    }
+
+    /* add the clauses of a product of sums */
+    bool
+    add_cover (const Cover &cnf)
+    {
+        assert(cnf.type == AND);
+        for (auto &C : cnf.cubes) {
+            std::vector<Lit> lits;
+            for (size_t w = 0; w < C.words(); w++) {
+                for (uint64_t m = C.pos[w]; m; m &= m - 1)
+                    lits.push_back((w * 64 + __builtin_ctzll(m)) << 1);
+                for (uint64_t m = C.neg[w]; m; m &= m - 1)
+                    lits.push_back(((w * 64 + __builtin_ctzll(m)) << 1) | 1);
+            }
+            if (!add_clause(lits))
+                return false;
+        }
+        return ok;
+    }
+
+    /*
+     * Find a model of the clauses in which every literal of `assumptions' is
+     * true, which is left in `model' indexed by variable. The assumptions
+     * only hold for this call: everything learned along the way follows from
+     * the clauses alone and is kept for the next, so many queries against
+     * one set of clauses are cheap. When the assumptions can't all hold,
+     * `failed' is the ones which together contradict the clauses.
+     */
+    SatResult
+    solve (const std::vector<Lit> &assumptions = std::vector<Lit>())
+    {
+        SatResult result = UNKNOWN;
+
+        model.clear();
+        failed.clear();
+        if (!ok)
+            return UNSATISFIABLE;
+
+        for (auto l : assumptions)
+            add_var(var(l));
+        this->assumptions = assumptions;
+        if (max_learnts == 0)
+            max_learnts = std::max((double) clauses.size() / 3, 1000.0);
+        for (uint64_t restarts = 0; result == UNKNOWN; restarts++)
+            result = search(luby(restarts) * RESTART_BASE);
+
+        cancel_until(0);
+        return result;
+    }
+
+private:
+    void
+    assign (Lit l, uint32_t from)
+    {
+        uint32_t v = var(l);
+        values[l] = 1;
+        values[l ^ 1] = -1;
+        level[v] = decision_level();
+        reason[v] = from;
+        trail.push_back(l);
+    }
+
+    void
+    attach (const std::vector<Lit> &lits, bool learnt)
+    {
+        clauses.push_back(Clause{ lits, learnt, false, 0 });
+        watches[lits[0] ^ 1].push_back(Watch{ (uint32_t) clauses.size() - 1,
+                                              lits[1] });
+        watches[lits[1] ^ 1].push_back(Watch{ (uint32_t) clauses.size() - 1,
+                                              lits[0] });
+        if (learnt)
+            learnts++;
+    }
+
+    /*
+     * Assign everything the current assignments imply. Returns the clause
+     * with every literal false if there is one.
+     */
+    uint32_t
+    propagate ()
+    {
+        uint32_t conflict = NO_CLAUSE;
+
+        while (qhead < trail.size() && conflict == NO_CLAUSE) {
+            Lit p = trail[qhead++];
+            Lit false_lit = p ^ 1;
+            std::vector<Watch> &ws = watches[p];
+            size_t i = 0, j = 0;
+
+            propagations++;
+            while (i < ws.size()) {
+                Watch w = ws[i++];
+                if (value(w.blocker) > 0) {
+                    ws[j++] = w;
+                    continue;
+                }
+
+                std::vector<Lit> &c = clauses[w.clause].lits;
+                if (c[0] == false_lit)
+                    std::swap(c[0], c[1]);
+                Lit first = c[0];
+                if (first != w.blocker && value(first) > 0) {
+                    ws[j++] = Watch{ w.clause, first };
+                    continue;
+                }
+
+                /* look for another literal to watch */
+                bool moved = false;
+                for (size_t k = 2; k < c.size(); k++) {
+                    if (value(c[k]) >= 0) {
+                        std::swap(c[1], c[k]);
+                        watches[c[1] ^ 1].push_back(Watch{ w.clause, first });
+                        moved = true;
+                        break;
+                    }
+                }
+                if (moved)
+                    continue;
+
+                /* the clause is unit or in conflict */
+                ws[j++] = Watch{ w.clause, first };
+                if (value(first) < 0) {
+                    conflict = w.clause;
+                    qhead = trail.size();
+                    while (i < ws.size())
+                        ws[j++] = ws[i++];
+                } else {
+                    assign(first, w.clause);
+                }
+            }
+            ws.resize(j);
+        }
+        return conflict;
+    }
+
+    void
+    bump_var (uint32_t v)
+    {
+        if ((activity[v] += var_inc) > 1e100) {
+            for (auto &a : activity)
+                a *= 1e-100;
+            var_inc *= 1e-100;
+        }
+        order.raised(v);
+    }
+
+    void
+    bump_clause (Clause &c)
+    {
+        if ((c.activity += clause_inc) > 1e20) {
+            for (auto &d : clauses)
+                if (d.learnt)
+                    d.activity *= 1e-20;
+            clause_inc *= 1e-20;
+        }
+    }
+
+    /*
+     * Is the literal implied by the other literals of the learned clause,
+     * following reasons back until only those literals (which are `seen')
+     * are left. `levels' is a bitmask of the levels in the clause so most
+     * dead ends are cut without walking them.
+     */
+    bool
+    redundant (Lit p, uint32_t levels)
+    {
+        std::vector<Lit> stack(1, p);
+        size_t top = to_clear.size();
+
+        while (!stack.empty()) {
+            Lit q = stack.back();
+            stack.pop_back();
+            const std::vector<Lit> &c = clauses[reason[var(q)]].lits;
+            for (size_t i = 1; i < c.size(); i++) {
+                uint32_t v = var(c[i]);
+                if (seen[v] || level[v] == 0)
+                    continue;
+                if (reason[v] == NO_CLAUSE ||
+                    !((1u << (level[v] & 31)) & levels)) {
+                    for (size_t j = top; j < to_clear.size(); j++)
+                        seen[var(to_clear[j])] = false;
+                    to_clear.resize(top);
+                    return false;
+                }
+                seen[v] = true;
+                stack.push_back(c[i]);
+                to_clear.push_back(c[i]);
+            }
+        }
+        return true;
+    }
+
+    /*
+     * Learn a clause from the conflict: resolve the conflict with the reasons
+     * of its literals from the current level until only one of them (the
+     * first unique implication point) is left, then drop the literals the
+     * rest imply. Returns the level to go back to, where the clause is unit.
+     */
+    uint32_t
+    analyze (uint32_t conflict, std::vector<Lit> &learnt)
+    {
+        size_t index = trail.size();
+        int pending = 0;
+        Lit p = NO_LIT;
+        uint32_t levels = 0, back = 0;
+
+        learnt.assign(1, NO_LIT);
+        do {
+            Clause &c = clauses[conflict];
+            if (c.learnt)
+                bump_clause(c);
+            for (size_t i = (p == NO_LIT) ? 0 : 1; i < c.lits.size(); i++) {
+                Lit q = c.lits[i];
+                uint32_t v = var(q);
+                if (seen[v] || level[v] == 0)
+                    continue;
+                seen[v] = true;
+                bump_var(v);
+                if (level[v] >= decision_level())
+                    pending++;
+                else
+                    learnt.push_back(q);
+            }
+            while (!seen[var(trail[--index])])
+                ;
+            p = trail[index];
+            conflict = reason[var(p)];
+            seen[var(p)] = false;
+            pending--;
+        } while (pending > 0);
+        learnt[0] = p ^ 1;
+
+        to_clear.assign(learnt.begin(), learnt.end());
+        for (size_t i = 1; i < learnt.size(); i++)
+            levels |= 1u << (level[var(learnt[i])] & 31);
+        size_t j = 1;
+        for (size_t i = 1; i < learnt.size(); i++)
+            if (reason[var(learnt[i])] == NO_CLAUSE ||
+                !redundant(learnt[i], levels))
+                learnt[j++] = learnt[i];
+        learnt.resize(j);
+        for (auto l : to_clear)
+            seen[var(l)] = false;
+
+        /* the literal of the highest level after the UIP is watched */
+        for (size_t i = 1; i < learnt.size(); i++) {
+            if (level[var(learnt[i])] > back) {
+                back = level[var(learnt[i])];
+                std::swap(learnt[1], learnt[i]);
+            }
+        }
+        return back;
+    }
+
+    /*
+     * The assumption p is false: collect the assumptions it follows from
+     * into `failed', walking the reasons back from p down the trail.
+     */
+    void
+    analyze_final (Lit p)
+    {
+        failed.assign(1, p ^ 1);
+        if (decision_level() == 0)
+            return;
+
+        seen[var(p)] = true;
+        for (size_t i = trail.size(); i > trail_lim[0]; i--) {
+            uint32_t v = var(trail[i - 1]);
+            if (!seen[v])
+                continue;
+            if (reason[v] == NO_CLAUSE) {
+                /* every decision so far is an assumption */
+                failed.push_back(trail[i - 1]);
+            } else {
+                const std::vector<Lit> &c = clauses[reason[v]].lits;
+                for (size_t j = 1; j < c.size(); j++)
+                    if (level[var(c[j])] > 0)
+                        seen[var(c[j])] = true;
+            }
+            seen[v] = false;
+        }
+        seen[var(p)] = false;
+    }
+
+    void
+    cancel_until (uint32_t target)
+    {
+        if (decision_level() <= target)
+            return;
+        for (size_t i = trail.size(); i > trail_lim[target]; i--) {
+            uint32_t v = var(trail[i - 1]);
+            phase[v] = trail[i - 1] & 1;
+            values[trail[i - 1]] = 0;
+            values[trail[i - 1] ^ 1] = 0;
+            reason[v] = NO_CLAUSE;
+            order.insert(v);
+        }
+        trail.resize(trail_lim[target]);
+        trail_lim.resize(target);
+        qhead = trail.size();
+    }
+
+    /* the next decision, NO_LIT once every variable is assigned */
+    Lit
+    pick ()
+    {
+        while (!order.empty()) {
+            uint32_t v = order.pop();
+            if (values[v << 1] == 0)
+                return (v << 1) | phase[v];
+        }
+        return NO_LIT;
+    }
+
+    /*
+     * Drop the less active half of the learned clauses, keeping binary
+     * ones. This is only done at level 0, where no clause is the reason for
+     * anything analysis will look at, so the clauses can be renumbered.
+     */
+    void
+    reduce_learnts ()
+    {
+        std::vector<uint32_t> candidates;
+        std::vector<Clause> kept;
+
+        for (uint32_t i = 0; i < clauses.size(); i++)
+            if (clauses[i].learnt && clauses[i].lits.size() > 2)
+                candidates.push_back(i);
+        std::sort(candidates.begin(), candidates.end(),
+                  [&](uint32_t a, uint32_t b) {
+            return clauses[a].activity < clauses[b].activity;
+        });
+        for (size_t i = 0; i < candidates.size() / 2; i++)
+            clauses[candidates[i]].deleted = true;
+
+        learnts = 0;
+        for (uint32_t i = 0; i < clauses.size(); i++) {
+            if (clauses[i].deleted)
+                continue;
+            learnts += clauses[i].learnt;
+            kept.push_back(clauses[i]);
+        }
+        clauses.swap(kept);
+
+        for (auto &ws : watches)
+            ws.clear();
+        for (uint32_t i = 0; i < clauses.size(); i++) {
+            const std::vector<Lit> &c = clauses[i].lits;
+            watches[c[0] ^ 1].push_back(Watch{ i, c[1] });
+            watches[c[1] ^ 1].push_back(Watch{ i, c[0] });
+        }
+        for (auto &r : reason)
+            r = NO_CLAUSE;
+    }
+
+    /*
+     * Run until a model is found, the clauses are found unsatisfiable or
+     * there have been `budget' conflicts, when it goes back to level 0 to
+     * restart.
+     */
+    SatResult
+    search (uint64_t budget)
+    {
+        std::vector<Lit> learnt;
+        uint64_t found = 0;
+
+        while (true) {
+            uint32_t conflict = propagate();
+
+            if (conflict != NO_CLAUSE) {
+                conflicts++;
+                found++;
+                if (decision_level() == 0) {
+                    ok = false;
+                    return UNSATISFIABLE;
+                }
+                cancel_until(analyze(conflict, learnt));
+                if (learnt.size() == 1) {
+                    assign(learnt[0], NO_CLAUSE);
+                } else {
+                    attach(learnt, true);
+                    bump_clause(clauses.back());
+                    assign(learnt[0], clauses.size() - 1);
+                }
+                var_inc /= 0.95;
+                clause_inc /= 0.999;
+                continue;
+            }
+
+            if (found >= budget) {
+                cancel_until(0);
+                if (learnts >= max_learnts + trail.size()) {
+                    reduce_learnts();
+                    max_learnts *= 1.1;
+                }
+                return UNKNOWN;
+            }
+
+            Lit next = NO_LIT;
+            while (next == NO_LIT && decision_level() < assumptions.size()) {
+                Lit p = assumptions[decision_level()];
+                if (value(p) > 0) {
+                    /* already true, an empty level keeps them lined up */
+                    trail_lim.push_back(trail.size());
+                } else if (value(p) < 0) {
+                    analyze_final(p ^ 1);
+                    return UNSATISFIABLE;
+                } else {
+                    next = p;
+                }
+            }
+            if (next == NO_LIT)
+                next = pick();
+            if (next == NO_LIT) {
+                model.assign(vars(), false);
+                for (uint32_t v = 0; v < vars(); v++)
+                    model[v] = value(v << 1) > 0;
+                return SATISFIABLE;
+            }
+            decisions++;
+            trail_lim.push_back(trail.size());
+            assign(next, NO_CLAUSE);
+        }
+    }
+
+    /* the Luby sequence 1 1 2 1 1 2 4 1 1 2 ... */
+    static uint64_t
+    luby (uint64_t i)
+    {
+        uint64_t size = 1, power = 0;
+
+        while (size < i + 1) {
+            power++;
+            size = 2 * size + 1;
+        }
+        while (size - 1 != i) {
+            size = (size - 1) / 2;
+            power--;
+            i = i % size;
+        }
+        return (uint64_t) 1 << power;
+    }
+};
+
+/*
+ * Add N to the solver, taking its clauses as they are if it is already a CNF
+ * (such as the output of to_cnf) or its Tseitin encoding otherwise. The
+ * variables of N in a model of the encoding are a model of N, so assumptions
+ * on them ask about the cofactors of N. Returns false if N is unsatisfiable
+ * without a decision.
+ */
+bool
+load (Solver &solver, const Store &S, NodeId N)
+{
+    Cover C(AND);
+
+    if (!to_cover(S, N, AND, C))
+        C = tseitin(S, N, first_aux_var(S, N));
+    return solver.add_cover(C);
+}
+
+/* load N and solve it */
+SatResult
+satisfy (Solver &solver, const Store &S, NodeId N)
+{
+    load(solver, S, N);
+    return solver.solve();
+}
+
+/*
+ * The literals of the product N, e.g. a!b, as assumptions. A variable it has
+ * both ways round gives both literals so the solver finds the contradiction.
+ * Returns false if N isn't a single product.
+ */
+bool
+product_assumptions (const Store &S, NodeId N, std::vector<Lit> &assumptions)
+{
+    Cover term(OR);
+
+    if (!to_cover(S, N, OR, term) || term.cubes.size() != 1)
+        return false;
+    for (size_t v = 0; v < 64 * term.cubes[0].words(); v++) {
+        if (term.cubes[0].has(v, false))
+            assumptions.push_back(literal(v, false));
+        if (term.cubes[0].has(v, true))
+            assumptions.push_back(literal(v, true));
+    }
+    return true;
+}
+
+/* the model restricted to the variables of N as a product, e.g. a!bc */
+NodeId
+model_term (Store &S, NodeId N, const std::vector<bool> &model)
+{
+    std::vector<NodeId> literals;
+
+    for (auto v : support(S, N))
+        literals.push_back(S.make_var(v, v >= model.size() || !model[v]));
+    if (literals.empty())
+        return S.make(TRUE);
+    if (literals.size() == 1)
+        return literals[0];
+    return S.make(AND, literals);
+}
+
+#endif
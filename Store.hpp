@@ -0,0 +1,270 @@
+#ifndef STORE_HPP
+#define STORE_HPP
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdint>
+#include "Node.hpp"
+
+typedef uint32_t NodeId;
+
+static const NodeId NO_NODE = UINT32_MAX;
+
+/*
+ * A hash-consed store of expression nodes. Every structurally unique
+ * subexpression is stored exactly once and is referred to by its NodeId, so
+ * two equal subtrees are always the same id and comparing them is an integer
+ * compare.
+ *
+ * Children of a node are kept as a sorted and de-duplicated list of ids. That
+ * gives each set of children a single canonical representation which is all
+ * the unique table needs. The order is *not* the order used for printing; use
+ * `node' to get a Node tree back out which sorts its children the usual way.
+ */
+struct Store {
+    struct Entry {
+        NodeType type;
+        bool negated;
+        uint32_t var;
+        uint32_t first; /* offset of the children in `kids' */
+        uint32_t size;
+        uint64_t hash;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<NodeId> kids;
+    /* open-addressed unique table of ids, power of two sized */
+    std::vector<NodeId> table;
+
+    Store ()
+        : table(1024, NO_NODE)
+    { }
+
+    NodeType
+    type (NodeId id) const
+    {
+        return entries[id].type;
+    }
+
+    uint32_t
+    var (NodeId id) const
+    {
+        return entries[id].var;
+    }
+
+    bool
+    negated (NodeId id) const
+    {
+        return entries[id].negated;
+    }
+
+    size_t
+    size (NodeId id) const
+    {
+        return entries[id].size;
+    }
+
+    /*
+     * Children are fetched by index rather than by pointer because making a
+     * new node may grow `kids' and invalidate any pointer into it.
+     */
+    NodeId
+    child (NodeId id, size_t i) const
+    {
+        return kids[entries[id].first + i];
+    }
+
+    bool
+    is_operator (NodeId id) const
+    {
+        NodeType t = entries[id].type;
+        return (t == AND || t == OR || t == NOT);
+    }
+
+    size_t
+    count () const
+    {
+        return entries.size();
+    }
+
+    /* the constants TRUE and FALSE */
+    NodeId
+    make (NodeType type)
+    {
+        std::vector<NodeId> none;
+        return make(type, none);
+    }
+
+    /* the variable, e.g. "a" or "!a" */
+    NodeId
+    make_var (uint32_t var, bool negated)
+    {
+        std::vector<NodeId> none;
+        return make(VAR, none, var, negated);
+    }
+
+    /*
+     * Return the id of the node of `type' with the given children, creating
+     * it if it doesn't exist yet. The `children' are sorted and de-duplicated
+     * in place.
+     */
+    NodeId
+    make (NodeType type,
+          std::vector<NodeId> &children,
+          uint32_t var = 0,
+          bool negated = false)
+    {
+        uint64_t hash;
+        size_t mask, i;
+
+        std::sort(children.begin(), children.end());
+        children.erase(std::unique(children.begin(), children.end()),
+                       children.end());
+
+        hash = hash_of(type, var, negated, children);
+        mask = table.size() - 1;
+
+        for (i = hash & mask; table[i] != NO_NODE; i = (i + 1) & mask) {
+            if (equals(table[i], hash, type, var, negated, children))
+                return table[i];
+        }
+
+        Entry E;
+        E.type = type;
+        E.negated = negated;
+        E.var = var;
+        E.first = kids.size();
+        E.size = children.size();
+        E.hash = hash;
+        kids.insert(kids.end(), children.begin(), children.end());
+        entries.push_back(E);
+        table[i] = entries.size() - 1;
+
+        /* keep the load factor of the table under one half */
+        if (entries.size() * 2 > table.size())
+            grow();
+
+        return entries.size() - 1;
+    }
+
+    /*
+     * Copy the Node tree into the store.
+     */
+    NodeId
+    intern (const Node &N)
+    {
+        std::vector<NodeId> children;
+        children.reserve(N.children.size());
+        for (auto &child : N.children)
+            children.push_back(intern(child));
+        return make(N.type, children, N.var, N.negated);
+    }
+
+    /*
+     * Rebuild a Node tree from the store.
+     */
+    Node
+    node (NodeId id) const
+    {
+        Node N(type(id));
+        if (type(id) == VAR)
+            return Node(var(id), negated(id));
+        N.children.reserve(size(id));
+        for (size_t i = 0; i < size(id); i++)
+            N.add_child(node(child(id, i)));
+        return N;
+    }
+
+    /*
+     * Copy the node `id' of another store, and everything under it, into this
+     * one. `copied' maps the ids of `from' already copied to their ids here,
+     * so a shared subexpression is copied once.
+     */
+    NodeId
+    copy (const Store &from,
+          NodeId id,
+          std::unordered_map<NodeId, NodeId> &copied)
+    {
+        std::vector<NodeId> children;
+        NodeId result;
+
+        auto found = copied.find(id);
+        if (found != copied.end())
+            return found->second;
+        for (size_t i = 0; i < from.size(id); i++)
+            children.push_back(copy(from, from.child(id, i), copied));
+        result = make(from.type(id), children, from.var(id), from.negated(id));
+        copied[id] = result;
+        return result;
+    }
+
+    void
+    clear ()
+    {
+        entries.clear();
+        kids.clear();
+        std::fill(table.begin(), table.end(), NO_NODE);
+    }
+
+private:
+    static uint64_t
+    mix (uint64_t h, uint64_t v)
+    {
+        h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+        return h;
+    }
+
+    static uint64_t
+    hash_of (NodeType type,
+             uint32_t var,
+             bool negated,
+             const std::vector<NodeId> &children)
+    {
+        uint64_t h = 14695981039346656037ULL;
+        h = mix(h, type);
+        h = mix(h, ((uint64_t) var << 1) | negated);
+        for (auto id : children)
+            h = mix(h, id);
+        /* spread the low bits used for the table index */
+        h ^= h >> 29;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 32;
+        return h;
+    }
+
+    bool
+    equals (NodeId id,
+            uint64_t hash,
+            NodeType type,
+            uint32_t var,
+            bool negated,
+            const std::vector<NodeId> &children) const
+    {
+        const Entry &E = entries[id];
+        if (E.hash != hash || E.size != children.size() || E.type != type)
+            return false;
+        if (E.var != var || E.negated != negated)
+            return false;
+        return std::equal(children.begin(), children.end(),
+                          kids.begin() + E.first);
+    }
+
+    void
+    grow ()
+    {
+        size_t mask, i;
+
+        table.assign(table.size() * 2, NO_NODE);
+        mask = table.size() - 1;
+
+        for (NodeId id = 0; id < entries.size(); id++) {
+            for (i = entries[id].hash & mask; table[i] != NO_NODE;)
+                i = (i + 1) & mask;
+            table[i] = id;
+        }
+    }
+};
+
+#endif
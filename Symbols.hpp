@@ -0,0 +1,91 @@
+#ifndef SYMBOLS_HPP
+#define SYMBOLS_HPP
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+/*
+ * The names of the variables, interned to dense ids so that everything else
+ * only ever deals with the ids. The single letters are always 0-51, 'A'-'Z'
+ * then 'a'-'z', so comparing their ids orders them the same way as comparing
+ * their characters. Identifiers like req_valid get the next id the first time
+ * they are seen.
+ */
+struct Symbols {
+    std::vector<std::string> names;
+    std::unordered_map<std::string, uint32_t> ids;
+
+    Symbols ()
+    {
+        clear();
+    }
+
+    size_t
+    size () const
+    {
+        return names.size();
+    }
+
+    uint32_t
+    intern (const char *name, size_t length)
+    {
+        std::string key(name, length);
+        auto found = ids.find(key);
+
+        if (found != ids.end())
+            return found->second;
+        ids.emplace(key, names.size());
+        names.push_back(key);
+        return names.size() - 1;
+    }
+
+    uint32_t
+    intern (const std::string &name)
+    {
+        return intern(name.data(), name.size());
+    }
+
+    /*
+     * The name of a variable. Ids past the table are the new variables which
+     * encodings like Tseitin's add, and are named _1, _2, ... in order, which
+     * no identifier can be.
+     */
+    std::string
+    name (uint32_t id) const
+    {
+        if (id < names.size())
+            return names[id];
+        return "_" + std::to_string(id - names.size() + 1);
+    }
+
+    /*
+     * Forget every identifier, leaving the letters. This is cheap when there
+     * is nothing to forget so it can be done before every expression.
+     */
+    void
+    clear ()
+    {
+        if (names.empty()) {
+            for (char c = 'A'; c <= 'Z'; c++)
+                intern(&c, 1);
+            for (char c = 'a'; c <= 'z'; c++)
+                intern(&c, 1);
+            return;
+        }
+        for (size_t i = 52; i < names.size(); i++)
+            ids.erase(names[i]);
+        names.resize(52);
+    }
+};
+
+/*
+ * The table of the current thread. Nodes are printed with the table they were
+ * parsed with, so a node has to be printed on the thread which made it, and a
+ * worker which clears its table between expressions keeps the ids of each
+ * expression the same however the work is split up.
+ */
+static thread_local Symbols SYMBOLS;
+
+#endif
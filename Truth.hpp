@@ -0,0 +1,332 @@
+#ifndef TRUTH_HPP
+#define TRUTH_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cassert>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "Node.hpp"
+#include "Store.hpp"
+
+/*
+ * Truth tables are 2^n bits so past this they stop being a quick check.
+ */
+static const size_t MAX_TRUTH_VARS = 30;
+
+/*
+ * How many words of the table are evaluated at a time. Every node in the
+ * expression holds one block of words so this bounds the memory used.
+ */
+static const size_t TRUTH_BLOCK_WORDS = 256;
+
+/*
+ * The patterns of the first six variables within a single word: bit i of a
+ * word is assignment i so variable j is 1 wherever bit j of i is set. The
+ * variables after those are constant across a whole word.
+ */
+static const uint64_t VAR_PATTERNS[6] = {
+    0xaaaaaaaaaaaaaaaaULL,
+    0xccccccccccccccccULL,
+    0xf0f0f0f0f0f0f0f0ULL,
+    0xff00ff00ff00ff00ULL,
+    0xffff0000ffff0000ULL,
+    0xffffffff00000000ULL,
+};
+
+/*
+ * The word kernels. These do 8 or 4 words per instruction with AVX-512 or
+ * AVX2 when the compiler targets them and fall back to a word at a time.
+ */
+void
+and_words (uint64_t *dst, const uint64_t *src, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX512F__)
+    for (; i + 8 <= n; i += 8) {
+        __m512i a = _mm512_loadu_si512((const void *) (dst + i));
+        __m512i b = _mm512_loadu_si512((const void *) (src + i));
+        _mm512_storeu_si512((void *) (dst + i), _mm512_and_si512(a, b));
+    }
+#elif defined(__AVX2__)
+    for (; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (src + i));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_and_si256(a, b));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] &= src[i];
+}
+
+void
+or_words (uint64_t *dst, const uint64_t *src, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX512F__)
+    for (; i + 8 <= n; i += 8) {
+        __m512i a = _mm512_loadu_si512((const void *) (dst + i));
+        __m512i b = _mm512_loadu_si512((const void *) (src + i));
+        _mm512_storeu_si512((void *) (dst + i), _mm512_or_si512(a, b));
+    }
+#elif defined(__AVX2__)
+    for (; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (src + i));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_or_si256(a, b));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] |= src[i];
+}
+
+void
+not_words (uint64_t *dst, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX512F__)
+    const __m512i ones = _mm512_set1_epi64(-1);
+    for (; i + 8 <= n; i += 8) {
+        __m512i a = _mm512_loadu_si512((const void *) (dst + i));
+        _mm512_storeu_si512((void *) (dst + i), _mm512_xor_si512(a, ones));
+    }
+#elif defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi64x(-1);
+    for (; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (dst + i));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_xor_si256(a, ones));
+    }
+#endif
+    for (; i < n; i++)
+        dst[i] = ~dst[i];
+}
+
+/*
+ * The truth table of an expression over the variables `vars'. Bit i of `bits'
+ * is the value of the expression when variable vars[j] has the value of bit j
+ * of i. A table always has at least one word; with fewer than six variables
+ * the bits past 2^n are zero.
+ */
+struct TruthTable {
+    std::vector<uint32_t> vars;
+    std::vector<uint64_t> bits;
+
+    bool
+    value (uint64_t assignment) const
+    {
+        return (bits[assignment / 64] >> (assignment % 64)) & 1;
+    }
+
+    /* the number of satisfying assignments */
+    uint64_t
+    count () const
+    {
+        uint64_t n = 0;
+        for (auto w : bits)
+            n += __builtin_popcountll(w);
+        return n;
+    }
+
+    bool
+    operator== (const TruthTable &other) const
+    {
+        return vars == other.vars && bits == other.bits;
+    }
+
+    bool
+    operator!= (const TruthTable &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+/*
+ * The sorted variables used by the expression N.
+ */
+std::vector<uint32_t>
+support (const Store &S, NodeId N)
+{
+    std::vector<uint32_t> vars;
+    std::vector<bool> seen(S.count(), false);
+    std::vector<NodeId> stack(1, N);
+
+    while (!stack.empty()) {
+        NodeId id = stack.back();
+        stack.pop_back();
+        if (seen[id])
+            continue;
+        seen[id] = true;
+        if (S.type(id) == VAR)
+            vars.push_back(S.var(id));
+        for (size_t i = 0; i < S.size(id); i++)
+            stack.push_back(S.child(id, i));
+    }
+
+    std::sort(vars.begin(), vars.end());
+    vars.erase(std::unique(vars.begin(), vars.end()), vars.end());
+    return vars;
+}
+
+/*
+ * The nodes reachable from N with every child before its parent.
+ */
+std::vector<NodeId>
+postorder (const Store &S, NodeId N)
+{
+    std::vector<NodeId> order;
+    std::vector<bool> seen(S.count(), false);
+    /* the node and the index of the next child to visit */
+    std::vector<std::pair<NodeId, size_t>> stack;
+
+    stack.push_back(std::make_pair(N, 0));
+    seen[N] = true;
+    while (!stack.empty()) {
+        NodeId id = stack.back().first;
+        size_t i = stack.back().second;
+        if (i == S.size(id)) {
+            order.push_back(id);
+            stack.pop_back();
+            continue;
+        }
+        stack.back().second++;
+        NodeId c = S.child(id, i);
+        if (!seen[c]) {
+            seen[c] = true;
+            stack.push_back(std::make_pair(c, 0));
+        }
+    }
+    return order;
+}
+
+/*
+ * Fill `n' words starting at word `base' of the table with the pattern of
+ * table variable j.
+ */
+void
+var_words (uint64_t *dst, size_t j, size_t base, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (j < 6)
+            dst[i] = VAR_PATTERNS[j];
+        else
+            dst[i] = ((base + i) >> (j - 6)) & 1 ? ~0ULL : 0;
+    }
+}
+
+/*
+ * Evaluate N for every assignment of `vars', which must hold every variable
+ * of N. Each node is evaluated for a block of words at once, children
+ * before parents, so every operator is a run of word-wide AND/OR/NOT.
+ */
+TruthTable
+truth_table (const Store &S, NodeId N, const std::vector<uint32_t> &vars)
+{
+    TruthTable T;
+    std::vector<NodeId> order = postorder(S, N);
+    std::vector<size_t> slot(S.count(), 0);
+    std::vector<size_t> column;
+    std::vector<uint64_t> values;
+    size_t words, block;
+
+    assert(vars.size() <= MAX_TRUTH_VARS);
+
+    T.vars = vars;
+    words = vars.size() < 6 ? 1 : (size_t) 1 << (vars.size() - 6);
+    block = std::min(words, TRUTH_BLOCK_WORDS);
+    T.bits.assign(words, 0);
+    values.assign(order.size() * block, 0);
+
+    for (size_t k = 0; k < order.size(); k++)
+        slot[order[k]] = k;
+    for (size_t j = 0; j < vars.size(); j++) {
+        if (vars[j] >= column.size())
+            column.resize(vars[j] + 1, 0);
+        column[vars[j]] = j;
+    }
+
+    auto row = [&](NodeId id) { return &values[slot[id] * block]; };
+
+    for (size_t base = 0; base < words; base += block) {
+        for (size_t k = 0; k < order.size(); k++) {
+            NodeId id = order[k];
+            uint64_t *dst = &values[k * block];
+
+            switch (S.type(id)) {
+                case TRUE:
+                    std::fill(dst, dst + block, ~0ULL);
+                    break;
+                case FALSE:
+                    std::fill(dst, dst + block, 0);
+                    break;
+                case VAR:
+                    var_words(dst, column[S.var(id)], base, block);
+                    if (S.negated(id))
+                        not_words(dst, block);
+                    break;
+                default:
+                    std::copy(row(S.child(id, 0)), row(S.child(id, 0)) + block,
+                              dst);
+                    for (size_t i = 1; i < S.size(id); i++) {
+                        if (S.type(id) == AND)
+                            and_words(dst, row(S.child(id, i)), block);
+                        else
+                            or_words(dst, row(S.child(id, i)), block);
+                    }
+                    if (S.type(id) == NOT)
+                        not_words(dst, block);
+                    break;
+            }
+        }
+        std::copy(row(N), row(N) + block, T.bits.begin() + base);
+    }
+
+    if (vars.size() < 6)
+        T.bits[0] &= (1ULL << (1 << vars.size())) - 1;
+
+    return T;
+}
+
+TruthTable
+truth_table (const Store &S, NodeId N)
+{
+    return truth_table(S, N, support(S, N));
+}
+
+/*
+ * The variables of both expressions, so two tables can be compared.
+ */
+std::vector<uint32_t>
+support (const Store &S, NodeId A, NodeId B)
+{
+    std::vector<uint32_t> a = support(S, A), b = support(S, B), vars;
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(),
+                   std::back_inserter(vars));
+    return vars;
+}
+
+bool
+equivalent (const Store &S, NodeId A, NodeId B)
+{
+    std::vector<uint32_t> vars;
+
+    if (A == B)
+        return true;
+    vars = support(S, A, B);
+    return truth_table(S, A, vars) == truth_table(S, B, vars);
+}
+
+bool
+satisfiable (const Store &S, NodeId N)
+{
+    return truth_table(S, N).count() > 0;
+}
+
+uint64_t
+count_models (const Store &S, NodeId N)
+{
+    return truth_table(S, N).count();
+}
+
+#endif
@@ -0,0 +1,183 @@
+#include <chrono>
+#include <random>
+#include "Node.hpp"
+#include "Parse.hpp"
+#include "Store.hpp"
+#include "Form.hpp"
+
+/*
+ * Time each pass of the pipeline over many expressions and, when built with
+ * NODE_COUNTERS (make bench), count how many nodes each pass copies and
+ * moves. A pass which copies no more nodes than it handles copies each one at
+ * most once.
+ */
+
+struct Pass {
+    const char *name;
+    double seconds;
+    uint64_t copies;
+    uint64_t moves;
+    uint64_t nodes;
+};
+
+void
+usage (char *prog)
+{
+    fprintf(stderr, "Usage: %s [-j threads] [file]\n", prog);
+    exit(1);
+}
+
+/* a random expression of up to `depth' levels with the single letters */
+std::string
+random_expr (std::mt19937_64 &rng, int depth)
+{
+    std::string str;
+    int terms = 1 + rng() % 3;
+
+    for (int i = 0; i < terms; i++) {
+        int factors = 1 + rng() % 3;
+        if (i > 0)
+            str += "+";
+        for (int j = 0; j < factors; j++) {
+            if (depth > 0 && rng() % 4 == 0) {
+                str += (rng() % 3 == 0) ? "!(" : "(";
+                str += random_expr(rng, depth - 1);
+                str += ")";
+            } else {
+                if (rng() % 5 == 0)
+                    str += "!";
+                str += (char) ('a' + rng() % 12);
+            }
+        }
+    }
+    return str;
+}
+
+size_t
+count_nodes (const Node &N)
+{
+    size_t count = 1;
+    for (auto &child : N.children)
+        count += count_nodes(child);
+    return count;
+}
+
+/* run f as the pass P, adding its time and node copies and moves */
+template <typename F>
+void
+measure (Pass &P, F f)
+{
+#ifdef NODE_COUNTERS
+    uint64_t copies = NODE_COPIES, moves = NODE_MOVES;
+#endif
+    auto start = std::chrono::steady_clock::now();
+
+    P.nodes += f();
+
+    auto end = std::chrono::steady_clock::now();
+    P.seconds += std::chrono::duration<double>(end - start).count();
+#ifdef NODE_COUNTERS
+    P.copies += NODE_COPIES - copies;
+    P.moves += NODE_MOVES - moves;
+#endif
+}
+
+int
+main (int argc, char **argv)
+{
+    std::vector<std::string> lines;
+    Pass passes[] = {
+        { "parse", 0, 0, 0, 0 },
+        { "intern", 0, 0, 0, 0 },
+        { "cnf", 0, 0, 0, 0 },
+        { "output", 0, 0, 0, 0 },
+    };
+    Parser P;
+    Store S;
+    size_t printed = 0;
+    size_t jobs = 1;
+    char *prog = argv[0];
+
+    /* the threads each conversion may use, to compare against one */
+    if (argc >= 3 && strcmp(argv[1], "-j") == 0) {
+        char *end;
+        jobs = strtoul(argv[2], &end, 10);
+        if (*end != '\0' || jobs == 0)
+            usage(prog);
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc > 2)
+        usage(prog);
+    CONVERSION_WORKERS = jobs;
+
+    if (argc == 2) {
+        FILE *in = fopen(argv[1], "r");
+        char *line = NULL;
+        size_t capacity = 0;
+        ssize_t length;
+
+        if (!in) {
+            fprintf(stderr, "Cannot open '%s': %s\n", argv[1], strerror(errno));
+            exit(1);
+        }
+        while ((length = getline(&line, &capacity, in)) >= 0) {
+            while (length > 0 && isspace((unsigned char) line[length - 1]))
+                length--;
+            if (length > 0)
+                lines.push_back(std::string(line, length));
+        }
+        free(line);
+        fclose(in);
+    } else {
+        /* the same expressions every run so builds can be compared */
+        std::mt19937_64 rng(1);
+        for (int i = 0; i < 20000; i++)
+            lines.push_back(random_expr(rng, 2));
+    }
+
+    for (auto &line : lines) {
+        Node expr, out;
+        NodeId id = NO_NODE;
+
+        SYMBOLS.clear();
+        S.clear();
+        P.set_input(line);
+        measure(passes[0], [&] () {
+            if (!P.parse(expr)) {
+                fprintf(stderr, "%s: %s\n", line.c_str(), P.error.c_str());
+                exit(1);
+            }
+            return count_nodes(expr);
+        });
+        measure(passes[1], [&] () {
+            id = S.intern(expr);
+            return S.count();
+        });
+        measure(passes[2], [&] () {
+            size_t before = S.count();
+            id = to_cnf(S, id);
+            return S.count() - before;
+        });
+        measure(passes[3], [&] () {
+            out = S.node(id);
+            printed += out.logical_str().size();
+            return count_nodes(out);
+        });
+    }
+
+    printf("%zu expressions, %zu characters of CNF, %zu threads\n",
+           lines.size(), printed, jobs);
+    printf("%-8s %10s %12s %12s %12s\n", "pass", "seconds", "nodes",
+           "copies", "moves");
+    for (auto &pass : passes)
+        printf("%-8s %10.3f %12llu %12llu %12llu\n", pass.name, pass.seconds,
+               (unsigned long long) pass.nodes,
+               (unsigned long long) pass.copies,
+               (unsigned long long) pass.moves);
+#ifndef NODE_COUNTERS
+    printf("(build with -DNODE_COUNTERS to count copies and moves)\n");
+#endif
+
+    return 0;
+}
@@ -1,329 +1,322 @@
 #include <iostream>
+#include <atomic>
 #include "Node.hpp"
 #include "Parse.hpp"
+#include "Store.hpp"
+#include "Form.hpp"
+#include "Minimize.hpp"
+#include "Bdd.hpp"
+#include "Sat.hpp"
+#include "Pool.hpp"
+#include "Arena.hpp"
+
+/* batch output is written out once this much of it has built up */
+static const size_t OUTPUT_BUFFER = 1 << 16;
+/* the lines read in for the workers at once */
+static const size_t BATCH_CHUNK = 1 << 12;
 
 void
 usage (char *prog)
 {
-    fprintf(stderr, "Usage: %s <expression>\n", prog);
+    fprintf(stderr, "Usage: %s [-j threads] <expression> [parse|cnf|dnf|tseitin|minimize|bdd|sat|taut] [assumptions]\n", prog);
+    fprintf(stderr, "       %s [-j threads] [-s] -b <file|-> [mode]\n", prog);
     exit(1);
 }
 
 bool
-children_has_type (const Node &N, const std::string &type)
+known_mode (const std::string &mode)
 {
-    for (auto &child : N.children)
-        if (child.type == type)
-            return true;
-    return false;
+    return mode == "parse" || mode == "cnf" || mode == "dnf" ||
+           mode == "tseitin" || mode == "minimize" || mode == "bdd" ||
+           mode == "sat" || mode == "taut";
 }
 
+/*
+ * Apply the mode to the expression, appending the lines it prints to `out'.
+ * The tree `parse' prints on its own is left out here.
+ */
 void
-remove_children_of_type (Node &N, const std::string &type)
+transform (Store &S,
+           const Node &expr,
+           const std::string &mode,
+           const std::vector<Lit> &assumptions,
+           std::string &out)
 {
-    for (auto it = N.children.begin(); it != N.children.end();) {
-        if (it->type == type)
-            it = N.children.erase(it++);
-        else
-            it++;
+    NodeId id = S.intern(expr);
+
+    if (mode == "cnf")
+        id = to_cnf(S, id);
+    else if (mode == "dnf")
+        id = to_dnf(S, id);
+    else if (mode == "tseitin")
+        id = to_tseitin(S, id);
+    else if (mode == "minimize")
+        id = minimize(S, id);
+    else if (mode == "bdd") {
+        Bdd B;
+        B.set_order(dfs_order(expr));
+        id = from_cover(S, B.paths(B.build(expr)));
+        for (auto &r : B.reorderings)
+            fprintf(stderr, "Reordered %zu vertices into %zu\n", r.first,
+                    r.second);
+    }
+    else if (mode == "sat" || mode == "taut") {
+        Solver solver;
+        std::vector<NodeId> negated(1, id);
+        NodeId goal = (mode == "sat") ? id : S.make(NOT, negated);
+
+        load(solver, S, goal);
+        if (solver.solve(assumptions) == UNSATISFIABLE) {
+            out += (mode == "sat") ? "UNSAT\n" : "TAUTOLOGY\n";
+            return;
+        }
+        /* a model of the expression, or one which falsifies it */
+        out += (mode == "sat") ? "SAT\n" : "NOT TAUTOLOGY\n";
+        id = model_term(S, id, solver.model);
     }
-}
-
-void
-reduce_to_type (Node &N, const std::string &type)
-{
-    N.children.clear();
-    N.type = type;
-}
 
-/* a => !a; !a => a */
-Node
-negate_var (Node N)
-{
-    if (N.type[0] == '!')
-        return Node(std::string(1, N.type[1]));
-    else
-        return Node("!" + N.type);
+    out += S.node(id).logical_str();
+    out += '\n';
 }
 
-Node
-reduce (Node parent)
-{
-    std::set<Node> reduced_children;
-
-    if (parent.children.size() == 0)
-        return parent;
-
-    if (parent.children.size() > 0) {
-        for (auto &child : parent.children)
-            reduced_children.insert(reduce(child));
-        parent.children.clear();
-        for (auto &child : reduced_children)
-            parent.add_reduction(child);
+/*
+ * Results which finish out of order but are written in order: each waits in
+ * its slot until everything before it is out. Whichever worker finishes the
+ * next one moves the run of ready slots into the output buffer, so there is
+ * no thread just for writing.
+ */
+struct Reorder {
+    std::mutex lock;
+    std::vector<std::string> slots;
+    std::vector<bool> ready;
+    size_t next;
+    std::string out;
+
+    Reorder ()
+        : next(0)
+    {
+        out.reserve(2 * OUTPUT_BUFFER);
     }
 
-    /* a0bc => 0 */
-    if (parent.type == "*" && children_has_type(parent, "0")) {
-        reduce_to_type(parent, "0");
-        goto exit;
+    /* start over with `count' empty slots, keeping what they allocated */
+    void
+    reset (size_t count)
+    {
+        if (slots.size() < count)
+            slots.resize(count);
+        for (size_t i = 0; i < count; i++)
+            slots[i].clear();
+        ready.assign(count, false);
+        next = 0;
     }
 
-    /* a1bc => abc */
-    if (parent.type == "*" && children_has_type(parent, "1")) {
-        remove_children_of_type(parent, "1");
-        goto exit;
-    }
+    void
+    finish (size_t i)
+    {
+        std::lock_guard<std::mutex> guard(lock);
 
-    /* a+0+b+c => a+b+c */
-    if (parent.type == "+" && children_has_type(parent, "0")) {
-        remove_children_of_type(parent, "0");
-        goto exit;
+        ready[i] = true;
+        while (next < ready.size() && ready[next]) {
+            out += slots[next++];
+            if (out.size() >= OUTPUT_BUFFER)
+                flush();
+        }
     }
 
-    /* a+1+b+c => 1 */
-    if (parent.type == "+" && children_has_type(parent, "1")) {
-        reduce_to_type(parent, "1");
-        goto exit;
+    void
+    flush ()
+    {
+        fwrite(out.data(), 1, out.size(), stdout);
+        out.clear();
     }
-
-    /*
-     * For some var in values, if the negated var is contained in values, then
-     * we reduce. If we are 'ORing' then node becomes '1', if 'ANDing' then
-     * node becomes '1'.
-     * a+!a+b+c => 1
-     * a!abc => 0
-     */
-    for (auto &child : parent.children) {
-        if (child.is_operator())
-            continue;
-        if (parent.children.count(negate_var(child)) == 0)
-            continue;
-        if (parent.type == "+")
-            reduce_to_type(parent, "1");
-        else
-            reduce_to_type(parent, "0");
-        break;
-    }
-
-exit:
-    return parent;
-}
+};
 
 /*
- * We append values of the child at the iterator to Y. If there is no next
- * child (the iterator is at the end), then we can append Y to Z and start with
- * a new Y.
+ * Apply the mode to every line of `in', one expression to a line, and write
+ * the results in the same order. An empty line gives an empty line back, as
+ * does a line which doesn't parse after its error goes to stderr. Returns the
+ * number of those.
+ *
+ * The lines are read a chunk at a time and shared out over `jobs' workers.
+ * Each worker has its own parser, store, symbol table and node arena which
+ * it reuses from one expression to the next, so they share nothing but the
+ * output and a cache of the subtrees already converted, which catches the
+ * same subexpression in different lines. With `stats' the arenas' and the
+ * cache's counts go to stderr at the end.
  */
-void
-distribute_node (Node &Z,
-                 Node &Y,
-                 const std::set<Node>::iterator &it,
-                 const std::set<Node>::iterator &end)
+size_t
+batch (FILE *in, const std::string &mode, size_t jobs, bool stats)
 {
-    const Node &child = *it;
-
-    if (!child.is_operator()) {
-        Y.add_child(child);
-        if (std::next(it) == end) {
-            Z.add_reduction(Y);
-        } else {
-            distribute_node(Z, Y, std::next(it), end);
-        }
-    }
-    else {
-        /* 
-         * We keep this extra Node on the stack because the last child in this
-         * recursive 'for' loop is responsible for changing the final node in
-         * the string of nodes. If we didn't overwrite it every loop then all of
-         * its previously appended values would accumulate.
-         */
-        Node N;
-        for (auto &grandchild : child.children) {
-            N = Y;
-            N.add_reduction(grandchild);
-            if (std::next(it) == end) {
-                Z.add_reduction(N);
-            } else {
-                distribute_node(Z, N, std::next(it), end);
-            }
+    std::atomic<size_t> failed(0);
+    size_t first = 1;
+    std::vector<Lit> none;
+    std::vector<std::string> lines(BATCH_CHUNK);
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length = 0;
+    Pool pool(jobs);
+    std::vector<Parser> parsers(pool.workers());
+    std::vector<Store> stores(pool.workers());
+    std::vector<Arena> arenas(pool.workers());
+    ConversionCache cache;
+    Reorder results;
+
+    CONVERSION_CACHE = &cache;
+
+    while (length >= 0) {
+        size_t count = 0;
+        while (count < BATCH_CHUNK &&
+               (length = getline(&line, &capacity, in)) >= 0) {
+            while (length > 0 && (line[length - 1] == '\n' ||
+                                  line[length - 1] == '\r'))
+                length--;
+            lines[count++].assign(line, length);
         }
-    }
-}
-
-Node
-minimize_sets (Node &N)
-{
-    /*
-     * For each child of N:
-     * Apply any unilateral reduction rules to potentially remove itself.
-     * If Node is in wanted form, convert it to other form then back again.
-     * Otherwise just convert it to wanted form.
-     * Finally find the minimum sets using the containment algorithm below.
-     *
-     * Think carefully about recursive functions where two functions
-     * effectively call each other.
-     */
-    return N;
-}
 
-/*
- * For any child of N, if that child C can contain another child S then C is
- * redundant and should be filtered. We use this filtering process to find the
- * minimum sets.
- */
-void
-minimum_sets (Node &N)
-{
-    std::set<Node> filtered;
-    std::set<Node> children;
-
-    children = N.children;
-
-    for (auto &child : children) {
-        for (auto &set : children) {
-            bool contains = true;
-            if (set == child)
-                continue;
-            /* 
-             * if the child doesn't have any children but the set does, the
-             * child cannot contain that set.
-             */
-            if (child.children.size() == 0 && set.children.size() > 0) {
-                contains = false;
-            }
-            /*
-             * If the set has no children, then we test if child contains that
-             * set itself (because it must be a variable).
-             */
-            else if (child.children.size() > 0 && set.children.size() == 0) {
-                if (!child.children.count(set))
-                    contains = false;
-            }
-            /*
-             * Neither set or child will be equal here (because of the guard
-             * above). Thus if they both have no children, they must be
-             * different.
-             */
-            else if (child.children.size() == 0 && set.children.size() == 0) {
-                contains = false;
-            }
-            /*
-             * Otherwise we test that child can hold each and every child of
-             * set.
-             */
-            else {
-                for (auto &set_member : set.children) {
-                    if (!child.children.count(set_member)) {
-                        contains = false;
-                        break;
-                    }
+        results.reset(count);
+        pool.run(count, [&] (size_t i, size_t w) {
+            /* each expression numbers its own identifiers */
+            SYMBOLS.clear();
+            ARENA = &arenas[w];
+            {
+                Node expr;
+                parsers[w].set_input(lines[i]);
+                if (lines[i].empty()) {
+                    results.slots[i] = "\n";
+                } else if (!parsers[w].parse(expr)) {
+                    fprintf(stderr, "Line %zu: %s\n", first + i,
+                            parsers[w].error.c_str());
+                    results.slots[i] = "\n";
+                    failed++;
+                } else {
+                    stores[w].clear();
+                    transform(stores[w], expr, mode, none, results.slots[i]);
                 }
             }
-            if (contains)
-                filtered.insert(child);
-        }
-    }
-
-    /* add all non-filtered children to N */
-    N.children.clear();
-    for (auto &child : children) {
-        if (!filtered.count(child))
-            N.children.insert(child);
+            /* every node of the expression is gone by here */
+            arenas[w].reset();
+            ARENA = NULL;
+            results.finish(i);
+        });
+        first += count;
     }
-}
-
-Node to_cnf (Node &tree);
-Node to_dnf (Node &tree);
-
-/*
- * This converts the entire expression tree to CNF form from the leaves up to
- * the root node.
- *
- * We setup Z and Y so they can be used as references.  Z is the cummulative
- * Node where all different values of Y are inserted into. Y is used as an
- * intermediate node that has all the values of each child of the tree
- * iteratively appended to it.
- *
- * This is effectively an algorithm that creates, through the use of recursive
- * function calls, an N-deep 'for loop' for the children of the given tree.
- * Imagine the tree for 'ab+cd+ef', there would be 3 for loops. The string would
- * be a+c+e, then a+c+f, then a+d+e, etc. just like a for-loop works.
- *
- */
-Node
-conversion_dfs (Node tree, char expr_type, char clause_type)
-{
-	bool good_form = false;
-    std::set<Node> new_children;
-    Node Z(expr_type);
-    Node Y(clause_type);
-
-    if (tree.children.size() == 0)
-        return tree;
-
-    for (auto &child : tree.children)
-        new_children.insert(conversion_dfs(child, expr_type, clause_type));
-    tree.children.clear();
-    for (auto &child : new_children)
-        tree.add_reduction(child);
-
-    //int is_dnf, is_cnf;
-    //is_cnf = tree.is_cnf();
-    //is_dnf = tree.is_dnf();
-    //if (is_cnf && is_dnf)
-    //    return tree;
-
-    switch (expr_type) {
-        case '*': if (tree.is_cnf()) { good_form = true; } break;
-        case '+': if (tree.is_dnf()) { good_form = true; } break;
+    results.flush();
+    fflush(stdout);
+    free(line);
+    CONVERSION_CACHE = NULL;
+
+    if (stats) {
+        Arena total;
+        for (auto &A : arenas) {
+            total.allocations += A.allocations;
+            total.reused += A.reused;
+            total.mallocs += A.mallocs;
+            total.resets += A.resets;
+        }
+        fprintf(stderr, "%llu node allocations, %llu reused, %llu from the "
+                "heap, %llu resets\n",
+                (unsigned long long) total.allocations,
+                (unsigned long long) total.reused,
+                (unsigned long long) total.mallocs,
+                (unsigned long long) total.resets);
+        fprintf(stderr, "%llu conversion cache hits, %llu misses, %llu "
+                "evicted, %zu held\n",
+                (unsigned long long) cache.hits,
+                (unsigned long long) cache.misses,
+                (unsigned long long) cache.evictions, cache.size());
     }
-
-	if (good_form) {
-		/*
-		* TODO:
-		* Could be 'minimize sets' which converts it to the opposite form,
-		* does reductions, and other things.
-		*/
-		minimum_sets(tree);
-		return reduce(tree);
-	} else {
-		distribute_node(Z, Y, tree.children.begin(), tree.children.end());
-		minimum_sets(Z);
-		return reduce(Z);
-	}
-}
-
-Node
-to_cnf (Node &tree)
-{
-    return conversion_dfs(tree, '*', '+');
-}
-
-Node
-to_dnf (Node &tree)
-{
-    return conversion_dfs(tree, '+', '*');
+    return failed;
 }
 
 int
 main (int argc, char **argv)
 {
-    Node expr, orig;
+    Store S;
+    Node expr;
+    std::string mode = "parse";
+    std::vector<Lit> assumptions;
+    std::string out;
+    size_t jobs = 1;
+    bool stats = false;
+    char *prog = argv[0];
+
+    /* the options go before -b or the expression */
+    while (argc >= 2 && (strcmp(argv[1], "-j") == 0 ||
+                         strcmp(argv[1], "-s") == 0)) {
+        if (strcmp(argv[1], "-s") == 0) {
+            stats = true;
+            argc--;
+            argv++;
+        } else {
+            char *end;
+            if (argc < 3)
+                usage(prog);
+            jobs = strtoul(argv[2], &end, 10);
+            if (*end != '\0' || jobs == 0)
+                usage(prog);
+            argc -= 2;
+            argv += 2;
+        }
+    }
+    if (stats && (argc < 2 || strcmp(argv[1], "-b") != 0))
+        usage(prog);
 
-    if (argc != 2)
-        usage(argv[0]);
+    if (argc < 2 || argc > 4)
+        usage(prog);
 
     if (strlen(argv[1]) == 0)
-        usage(argv[0]);
+        usage(prog);
+
+    if (strcmp(argv[1], "-b") == 0) {
+        FILE *in = stdin;
+
+        if (argc < 3)
+            usage(prog);
+        if (argc == 4)
+            mode = argv[3];
+        if (!known_mode(mode))
+            usage(prog);
+        if (strcmp(argv[2], "-") != 0 && !(in = fopen(argv[2], "r"))) {
+            fprintf(stderr, "Cannot open '%s': %s\n", argv[2], strerror(errno));
+            exit(1);
+        }
+        size_t failed = batch(in, mode, jobs, stats);
+        if (in != stdin)
+            fclose(in);
+        return failed ? 1 : 0;
+    }
 
-    set_input(std::string(argv[1]));
+    if (argc >= 3)
+        mode = argv[2];
+    if (!known_mode(mode))
+        usage(prog);
+    /* only sat and taut solve under assumptions */
+    if (argc == 4 && mode != "sat" && mode != "taut")
+        usage(prog);
+
+    /* one expression has the threads to itself to multiply out with */
+    CONVERSION_WORKERS = jobs;
+
+    Parser P(argv[1], strlen(argv[1]));
+    if (!P.parse(expr)) {
+        fprintf(stderr, "%s\n", P.error.c_str());
+        exit(1);
+    }
+
+    if (mode == "parse")
+        expr.print_tree();
 
-    expr = parse_input();
-    expr.print_tree();
-    std::cout << expr.logical_str() << std::endl;
+    /* the assumptions for sat and taut are a product of literals, e.g. a!b */
+    if (argc == 4) {
+        Node assumed;
+        P.set_input(argv[3], strlen(argv[3]));
+        if (!P.parse(assumed) ||
+            !product_assumptions(S, S.intern(assumed), assumptions))
+            usage(prog);
+    }
 
-    //expr = to_cnf(expr);
-    //expr = to_dnf(expr);
+    transform(S, expr, mode, assumptions, out);
+    fwrite(out.data(), 1, out.size(), stdout);
 
     /*
      * The following factors
@@ -336,7 +329,5 @@ main (int argc, char **argv)
      * dfkrs(c+v)(!n+w)
      */
 
-    //expr.print_tree();
-
     return 0;
 }
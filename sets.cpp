@@ -1,8 +1,8 @@
 #include <cstdio>
 #include <string>
-#include <set>
 #include <algorithm>
 #include <cassert>
+#include "Flat.hpp"
 
 typedef enum NodeType {
     AND, OR, NOT, VAR, NVAR, TRUE, FALSE
@@ -12,7 +12,7 @@ class Node {
 public:
     NodeType type;
     char val;
-    std::set<Node> children;
+    FlatSet<Node> children;
 
     Node () : type(FALSE), val('\0') { }
     Node (char var, bool negated) : type(negated ? NVAR : VAR), val(var) { }
@@ -150,10 +150,10 @@ public:
         this->children.insert(sub);
     }
 
-    std::set<Node>
+    FlatSet<Node>
     intersect (Node &other) const
     {
-        std::set<Node> S;
+        FlatSet<Node> S;
         set_intersection(this->children.begin(), this->children.end(),
                          other.children.begin(), other.children.end(),
                          std::inserter(S, S.begin()));
@@ -3,14 +3,139 @@
 
 #include "Node.hpp"
 #include "Parse.hpp"
+#include "Store.hpp"
+#include "Form.hpp"
+#include "Truth.hpp"
+#include "Minimize.hpp"
+#include "Bdd.hpp"
+#include "Sat.hpp"
+#include "Pool.hpp"
 #include <random>
 #include <vector>
+#include <set>
 #include <algorithm>
 
 Node rand_node (int &stop_chance, std::mt19937_64 &rng);
 Node add_var (std::mt19937_64 &rng);
 Node add_sub (int &stop_chance, std::mt19937_64 &rng);
 Node add_negation (int &stop_chance, std::mt19937_64 &rng);
+std::string rand_input (std::mt19937_64 &rng);
+
+/*
+ * The models of the Tseitin CNF of N must be exactly the models of N with
+ * some value for each new variable.
+ */
+bool
+tseitin_projects (Store &S, NodeId N)
+{
+    NodeId T = to_tseitin(S, N);
+    std::vector<uint32_t> vars = support(S, N, T);
+    size_t n = support(S, N).size();
+    TruthTable F = truth_table(S, N, support(S, N)), P = F;
+
+    /* too many new variables to check this way */
+    if (vars.size() > 20)
+        return true;
+
+    /* the new variables sort after the old so they are the high bits */
+    TruthTable C = truth_table(S, T, vars);
+    std::fill(P.bits.begin(), P.bits.end(), 0);
+    for (uint64_t m = 0; m < ((uint64_t) 1 << vars.size()); m++) {
+        uint64_t low = m & (((uint64_t) 1 << n) - 1);
+        if (C.value(m))
+            P.bits[low / 64] |= 1ULL << (low % 64);
+    }
+    return P == F;
+}
+
+/*
+ * The solver must find N satisfiable exactly when its truth table has a one,
+ * and then with a model which makes N true.
+ */
+bool
+solver_agrees (Store &S, NodeId N)
+{
+    Solver solver;
+    std::vector<NodeId> children(1, N);
+    bool sat = (satisfy(solver, S, N) == SATISFIABLE);
+
+    if (sat != satisfiable(S, N))
+        return false;
+    if (!sat)
+        return true;
+    /* the model must leave no way for N to be false */
+    children.assign(1, S.make(NOT, children));
+    children.push_back(model_term(S, N, solver.model));
+    return !satisfiable(S, S.make(AND, children));
+}
+
+/*
+ * Load N once and ask about random cofactors of it, each of which must be
+ * satisfiable exactly when N is with those literals, and when it isn't the
+ * failed assumptions must be enough to show it. Assuming a variable both ways
+ * round must be unsatisfiable whatever N is.
+ */
+bool
+assumptions_agree (Store &S, NodeId N, std::mt19937_64 &rng)
+{
+    std::vector<uint32_t> vars = support(S, N);
+    Solver solver;
+
+    load(solver, S, N);
+    for (int query = 0; query < 8; query++) {
+        std::vector<Lit> assumptions;
+        std::vector<NodeId> children(1, N);
+        for (auto v : vars) {
+            if (rng() % 3 == 0) {
+                bool negated = rng() & 1;
+                assumptions.push_back(literal(v, negated));
+                children.push_back(S.make_var(v, negated));
+            }
+        }
+        NodeId cofactor = S.make(AND, children);
+        bool sat = (solver.solve(assumptions) == SATISFIABLE);
+        if (sat != satisfiable(S, cofactor))
+            return false;
+        if (sat) {
+            for (auto l : assumptions)
+                if (solver.model[l >> 1] == (l & 1))
+                    return false;
+            continue;
+        }
+
+        /* N with only the failed assumptions must be unsatisfiable too */
+        children.assign(1, N);
+        for (auto l : solver.failed) {
+            if (std::find(assumptions.begin(), assumptions.end(), l) ==
+                assumptions.end())
+                return false;
+            children.push_back(S.make_var(l >> 1, l & 1));
+        }
+        if (satisfiable(S, S.make(AND, children)))
+            return false;
+    }
+
+    /* a product with a variable both ways round, as form takes them */
+    if (!vars.empty()) {
+        std::vector<Lit> assumptions;
+        std::vector<NodeId> literals;
+        uint32_t v = vars[rng() % vars.size()];
+
+        literals.push_back(S.make_var(v, false));
+        literals.push_back(S.make_var(v, true));
+        for (auto w : vars)
+            if (rng() % 3 == 0)
+                literals.push_back(S.make_var(w, rng() & 1));
+        if (!product_assumptions(S, S.make(AND, literals), assumptions) ||
+            solver.solve(assumptions) != UNSATISFIABLE)
+            return false;
+        for (auto l : solver.failed)
+            if (std::find(assumptions.begin(), assumptions.end(), l) ==
+                assumptions.end())
+                return false;
+    }
+    return true;
+}
 
 /*
  * Generate a new test case. This means randomly generating a new parse tree
@@ -21,14 +146,14 @@ Node add_negation (int &stop_chance, std::mt19937_64 &rng);
  * Comparing the two trees is the our test.
  */
 bool
-generate_test (bool verbose)
+generate_test (bool verbose, std::mt19937_64 &rng)
 {
-    std::random_device device;
-    std::mt19937_64 rng(device());
     std::string input;
     int stop_chance;
     Node Tree, E;
+    Store S;
 
+    SYMBOLS.clear();
     stop_chance = 0;
     Tree = rand_node(stop_chance, rng);
     input = Tree.logical_str();
@@ -42,10 +167,96 @@ generate_test (bool verbose)
             E.print_tree();
         }
         return false;
-    } else if (verbose) {
-        printf("%s # %s ok\n", input.c_str(), E.logical_str(true).c_str());
     }
 
+    /* a prefix which leaves a parenthesis open must be an error */
+    size_t cut = rng() % (input.size() + 1);
+    Parser P(input.data(), cut);
+    Node Prefix;
+    if (std::count(input.begin(), input.begin() + cut, '(') >
+        std::count(input.begin(), input.begin() + cut, ')') &&
+        (P.parse(Prefix) || P.error.empty())) {
+        printf("Open prefix parses: '%s'\n", input.substr(0, cut).c_str());
+        return false;
+    }
+
+    /* equal trees must be the same node in the store and come back out */
+    if (S.intern(Tree) != S.intern(E) || S.node(S.intern(E)) != E) {
+        printf("Input fails to intern: '%s'\n", input.c_str());
+        return false;
+    }
+
+    /* the conversions must not change the truth table */
+    NodeId id = S.intern(E);
+    if (support(S, id).size() <= 16) {
+        if (!equivalent(S, id, to_cnf(S, id))) {
+            printf("CNF is not equivalent: '%s'\n", input.c_str());
+            return false;
+        }
+        if (!equivalent(S, id, to_dnf(S, id))) {
+            printf("DNF is not equivalent: '%s'\n", input.c_str());
+            return false;
+        }
+        /* espresso on every cover, not only the large ones */
+        Cover C(AND);
+        if (to_cover(S, to_cnf(S, id), AND, C)) {
+            espresso(C, ESPRESSO_ITERATIONS);
+            if (!equivalent(S, id, from_cover(S, C))) {
+                printf("Espresso is not equivalent: '%s'\n", input.c_str());
+                return false;
+            }
+        }
+    }
+    /*
+     * Equal functions must be the same BDD and its paths the same function,
+     * with the variables sifted all the way through.
+     */
+    Bdd B;
+    B.set_order(dfs_order(E));
+    B.reorder_threshold = 16;
+    BddId f = B.build(E);
+    if (f != B.build(S, to_cnf(S, id)) || f != B.build(S, to_dnf(S, id))) {
+        printf("BDD differs from the CNF or DNF: '%s'\n", input.c_str());
+        return false;
+    }
+    if (support(S, id).size() <= 16) {
+        if (!equivalent(S, id, from_cover(S, B.paths(f)))) {
+            printf("BDD paths are not equivalent: '%s'\n", input.c_str());
+            return false;
+        }
+    }
+
+    if (support(S, id).size() <= 10 && !tseitin_projects(S, id)) {
+        printf("Tseitin CNF is not equisatisfiable: '%s'\n", input.c_str());
+        return false;
+    }
+
+    /* both through the Tseitin encoding and straight from the CNF */
+    if (support(S, id).size() <= 16) {
+        std::vector<NodeId> negated(1, id);
+        if (!solver_agrees(S, id) || !solver_agrees(S, to_cnf(S, id)) ||
+            !solver_agrees(S, S.make(NOT, negated))) {
+            printf("Solver disagrees with the truth table: '%s'\n",
+                   input.c_str());
+            return false;
+        }
+        if (!assumptions_agree(S, id, rng)) {
+            printf("Solver under assumptions disagrees: '%s'\n",
+                   input.c_str());
+            return false;
+        }
+    }
+
+    if (support(S, id).size() <= 10) {
+        if (!equivalent(S, id, minimize(S, id))) {
+            printf("Minimized is not equivalent: '%s'\n", input.c_str());
+            return false;
+        }
+    }
+
+    if (verbose)
+        printf("%s # %s ok\n", input.c_str(), E.logical_str(true).c_str());
+
     return true;
 }
 
@@ -55,14 +266,17 @@ add_var (std::mt19937_64 &rng)
     static std::uniform_int_distribution<int> negated_choice(0, 100);
     /* range from a-z in ascii */
     static std::uniform_int_distribution<int> char_choice(97, 122);
-    std::string var;
-
-    if (negated_choice(rng) > 80)
-        var += '!';
-
-    var += static_cast<char>(char_choice(rng));
-    return Node(var);
+    static std::uniform_int_distribution<int> name_choice(0, 100);
+    static const char *identifiers[] = {
+        "req_valid", "fifo_full_3", "x1", "n_0"
+    };
+    bool negated = negated_choice(rng) > 80;
+    char var = static_cast<char>(char_choice(rng));
 
+    /* now and then a name longer than a letter */
+    if (name_choice(rng) > 95)
+        return Node(SYMBOLS.intern(identifiers[rng() % 4]), negated);
+    return Node(var_index(var), negated);
 }
 
 Node
@@ -74,7 +288,7 @@ add_sub (int &stop_chance, std::mt19937_64 &rng)
 Node
 add_negation (int &stop_chance, std::mt19937_64 &rng)
 {
-    Node N('!');
+    Node N(NOT);
     N.add_reduction(rand_node(stop_chance, rng));
     return N;
 }
@@ -105,11 +319,11 @@ rand_node (int &stop_chance, std::mt19937_64 &rng)
 
     Node N;
     switch (node_choice(rng)) {
-        case 0:  N = Node('+'); break;
-        default: N = Node('*'); break;
+        case 0:  N = Node(OR); break;
+        default: N = Node(AND); break;
     }
 
-    char choice;
+    char choice = 0;
     int rand;
     
     while (1) {
@@ -137,8 +351,7 @@ rand_node (int &stop_chance, std::mt19937_64 &rng)
                 N.add_reduction(add_sub(stop_chance, rng));
                 break;
             case '!':
-                N.add_reduction(add_sub(stop_chance, rng));
-                //N.add_child(add_negation(stop_chance, rng));
+                N.add_child(add_negation(stop_chance, rng));
                 break;
         }
     }
@@ -149,36 +362,330 @@ rand_node (int &stop_chance, std::mt19937_64 &rng)
     return N;
 }
 
+/*
+ * The logical string of a whole random tree. Every check draws from the one
+ * generator main seeds, so a run which fails can be repeated exactly by
+ * passing the seed it prints back in.
+ */
+std::string
+rand_input (std::mt19937_64 &rng)
+{
+    int stop_chance = 0;
+    return rand_node(stop_chance, rng).logical_str();
+}
+
 void
 usage (const char *prog)
 {
-    fprintf(stderr, "%s [<num-of-tests>] [<verbose=1|0>]\n", prog);
+    fprintf(stderr, "%s [<num-of-tests>] [<verbose=1|0>] [<seed>]\n", prog);
     exit(1);
 }
 
+/*
+ * Parse and convert expressions on several workers at once, each with its
+ * own parser and store, which must give what a single thread does.
+ */
+bool
+workers_agree (unsigned count, std::mt19937_64 &rng)
+{
+    std::vector<std::string> inputs, outputs(count);
+    Pool pool(4);
+    std::vector<Parser> parsers(pool.workers());
+    std::vector<Store> stores(pool.workers());
+    std::vector<Arena> arenas(pool.workers());
+    Store S;
+
+    for (unsigned i = 0; i < count; i++)
+        inputs.push_back(rand_input(rng));
+
+    /*
+     * As in batch mode, every expression numbers its own identifiers and its
+     * nodes come from an arena which is reset after it.
+     */
+    pool.run(count, [&] (size_t i, size_t w) {
+        Store &T = stores[w];
+        SYMBOLS.clear();
+        ARENA = &arenas[w];
+        {
+            Node E;
+            parsers[w].set_input(inputs[i]);
+            parsers[w].parse(E);
+            T.clear();
+            NodeId id = to_dnf(T, T.intern(E));
+            outputs[i] = T.node(id).logical_str();
+        }
+        arenas[w].reset();
+        ARENA = NULL;
+    });
+
+    for (unsigned i = 0; i < count; i++) {
+        SYMBOLS.clear();
+        set_input(inputs[i]);
+        if (S.node(to_dnf(S, S.intern(parse_input()))).logical_str() !=
+            outputs[i]) {
+            printf("Workers disagree with one thread: '%s'\n",
+                   inputs[i].c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Children are kept in a sorted array, which must hold the same nodes in the
+ * same order as a std::set given them in the same order would.
+ */
+bool
+flat_agrees (unsigned count, std::mt19937_64 &rng)
+{
+
+    for (unsigned i = 0; i < count; i++) {
+        std::set<Node> tree;
+        NodeSet flat;
+        int stop_chance = 50;
+
+        for (int j = rng() % 16; j >= 0; j--) {
+            Node N = (rng() % 2) ? add_var(rng) : rand_node(stop_chance, rng);
+            if (tree.insert(N).second != flat.insert(N).second) {
+                printf("Sorted children disagree inserting '%s'\n",
+                       N.logical_str().c_str());
+                return false;
+            }
+            stop_chance = 50;
+        }
+        if (tree.size() != flat.size() ||
+            !std::equal(tree.begin(), tree.end(), flat.begin())) {
+            printf("Sorted children are out of order\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * The cubes no other cube is in, the slow way, in the order minimum_sets
+ * keeps them.
+ */
+std::vector<Cube>
+naive_minimum (Cover C)
+{
+    std::vector<Cube> kept;
+
+    C.canonical();
+    for (auto &a : C.cubes) {
+        bool filtered = false;
+        for (auto &b : C.cubes)
+            if (!(a == b) && a.contains(b))
+                filtered = true;
+        if (!filtered)
+            kept.push_back(a);
+    }
+    std::stable_sort(kept.begin(), kept.end(),
+                     [](const Cube &a, const Cube &b) {
+                         return a.size() < b.size();
+                     });
+    return kept;
+}
+
+/*
+ * The subsumption index must keep exactly the cubes which no other is in,
+ * whether they are sorted first as in minimum_sets or come in any order as
+ * when distributing. The variables run past one word.
+ */
+bool
+absorption_agrees (unsigned count, std::mt19937_64 &rng)
+{
+
+    for (unsigned i = 0; i < count; i++) {
+        Cover C(AND);
+        Minimal Z;
+        std::vector<Cube> expect, unordered;
+        uint32_t vars = 4 + rng() % 80;
+
+        for (int j = rng() % 60; j >= 0; j--) {
+            Cube cube;
+            for (int k = rng() % 5; k > 0; k--)
+                cube.add(rng() % vars, rng() % 2);
+            C.add(cube);
+        }
+        expect = naive_minimum(C);
+
+        for (auto &cube : C.cubes)
+            if (!Z.subsumes(cube))
+                Z.add(cube);
+        Z.take(unordered);
+        for (auto &cube : unordered)
+            cube.widen(expect.empty() ? 1 : expect[0].words());
+        std::sort(unordered.begin(), unordered.end());
+
+        minimum_sets(C);
+        std::vector<Cube> sorted(expect);
+        std::sort(sorted.begin(), sorted.end());
+        if (!(C.cubes == expect) || !(unordered == sorted)) {
+            printf("Subsumption keeps the wrong cubes\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Converting over several workers must give exactly what one does, for any
+ * number of them. Subtrees of a few nodes are split off and every product
+ * is split up however small it is.
+ */
+bool
+conversions_agree (unsigned count, std::mt19937_64 &rng)
+{
+    size_t workers = CONVERSION_WORKERS, product = PARALLEL_PRODUCT;
+    size_t subtree = PARALLEL_SUBTREE;
+    bool agree = true;
+
+    PARALLEL_PRODUCT = 1;
+    PARALLEL_SUBTREE = 3;
+    for (unsigned i = 0; i < count && agree; i++) {
+        std::string input, expect[2];
+
+        SYMBOLS.clear();
+        input = rand_input(rng);
+        for (size_t w = 1; w <= 4 && agree; w++) {
+            Store S;
+            CONVERSION_WORKERS = w;
+            set_input(input);
+            NodeId id = S.intern(parse_input());
+            std::string cnf = S.node(to_cnf(S, id)).logical_str();
+            std::string dnf = S.node(to_dnf(S, id)).logical_str();
+            if (w == 1) {
+                expect[0] = cnf;
+                expect[1] = dnf;
+            } else if (cnf != expect[0] || dnf != expect[1]) {
+                printf("%zu workers convert differently: '%s'\n", w,
+                       input.c_str());
+                agree = false;
+            }
+        }
+    }
+    CONVERSION_WORKERS = workers;
+    PARALLEL_PRODUCT = product;
+    PARALLEL_SUBTREE = subtree;
+    return agree;
+}
+
+/*
+ * A conversion which finds its subtrees in the cache must give exactly what
+ * one without it does. Every expression is converted twice in a row, the
+ * second time out of the cache, and then its negation, whose subtrees are
+ * the same but for their literals. The cache is small enough that it keeps
+ * letting the older expressions go.
+ */
+bool
+cache_agrees (unsigned count, std::mt19937_64 &rng)
+{
+    std::vector<std::string> inputs, expect;
+    ConversionCache cache(64);
+    bool agree = true;
+
+    for (unsigned i = 0; i < count; i++) {
+        SYMBOLS.clear();
+        inputs.push_back(rand_input(rng));
+        /* the same subtrees with every literal the other way round */
+        inputs.push_back("!(" + inputs.back() + ")");
+    }
+    for (auto &input : inputs) {
+        Store S;
+
+        SYMBOLS.clear();
+        set_input(input);
+        NodeId id = S.intern(parse_input());
+        expect.push_back(S.node(to_cnf(S, id)).logical_str() + " " +
+                         S.node(to_dnf(S, id)).logical_str());
+    }
+
+    CONVERSION_CACHE = &cache;
+    for (size_t i = 0; i < inputs.size() && agree; i++) {
+        for (unsigned again = 0; again < 2 && agree; again++) {
+            Store S;
+
+            SYMBOLS.clear();
+            set_input(inputs[i]);
+            NodeId id = S.intern(parse_input());
+            std::string got = S.node(to_cnf(S, id)).logical_str() + " " +
+                              S.node(to_dnf(S, id)).logical_str();
+            if (got != expect[i]) {
+                printf("Cached conversion differs: '%s'\n",
+                       inputs[i].c_str());
+                agree = false;
+            }
+        }
+    }
+    CONVERSION_CACHE = NULL;
+
+    if (agree && cache.hits == 0) {
+        printf("Conversion cache never hit\n");
+        agree = false;
+    }
+
+    /* a hash which collides but with another size or support is a miss */
+    ConversionCache::Key key{ rng(), rng(), AND, 9, 0x6 };
+    ConversionCache::Key other = key;
+    Cover C(AND);
+    other.nodes++;
+    cache.insert(key, C);
+    if (agree && (cache.find(other, C) || !cache.find(key, C))) {
+        printf("Conversion cache takes a colliding subtree\n");
+        agree = false;
+    }
+    other = key;
+    other.support = 0x5;
+    if (agree && cache.find(other, C)) {
+        printf("Conversion cache takes a colliding subtree\n");
+        agree = false;
+    }
+    return agree;
+}
+
 int
 main (int argc, char **argv)
 {
     unsigned verbosity = false;
     unsigned num_tests = 1000;
+    unsigned long long seed = std::random_device()();
     bool all_passed = true;
 
-    if (argc < 2 || argc > 3)
+    if (argc < 2 || argc > 4)
         usage(argv[0]);
 
     sscanf(argv[1], "%u", &num_tests);
     if (argc > 2)
         sscanf(argv[2], "%u", &verbosity);
+    if (argc > 3)
+        sscanf(argv[3], "%llu", &seed);
+
+    std::mt19937_64 rng(seed);
 
     for (unsigned i = 0; i < num_tests; i++) {
-        bool passed = generate_test(verbosity);
+        bool passed = generate_test(verbosity, rng);
         if (all_passed && !passed)
             all_passed = false;
     }
+    if (!workers_agree(num_tests / 10 + 1, rng))
+        all_passed = false;
+    if (!flat_agrees(num_tests, rng))
+        all_passed = false;
+    if (!absorption_agrees(num_tests, rng))
+        all_passed = false;
+    if (!conversions_agree(num_tests / 10 + 1, rng))
+        all_passed = false;
+    if (!cache_agrees(num_tests / 10 + 1, rng))
+        all_passed = false;
 
-    if (all_passed)
-        printf("All tests passed. Good job.\n");
+    if (!all_passed) {
+        printf("Tests failed, repeat with: %s %u %u %llu\n", argv[0],
+               num_tests, verbosity, seed);
+        return 1;
+    }
 
+    printf("All tests passed. Good job.\n");
     return 0;
 }
 